@@ -0,0 +1,70 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+
+//chunked bump allocator for short lived objects (tree nodes, aggregate bodies)
+//objects are never freed one by one, reset() rewinds the whole pool and
+//keeps the chunks around so the next step doesn't touch malloc at all
+template <typename T>
+class Pool {
+public:
+    explicit Pool(std::size_t chunk_size = 4096) {
+        this->chunk_size = chunk_size;
+        this->chunk = 0;
+        this->used = 0;
+        this->count = 0;
+        this->peak = 0;
+    }
+
+    Pool(const Pool&) = delete;
+    Pool& operator = (const Pool&) = delete;
+
+    template <typename... Args>
+    T* create(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "pool objects are never destroyed");
+
+        if(used == chunk_size) {
+            chunk++;
+            used = 0;
+        }
+        if(chunk == chunks.size()) {
+            chunks.emplace_back(new unsigned char[chunk_size * sizeof(T)]);
+        }
+
+        void *p = chunks[chunk].get() + used * sizeof(T);
+        used++;
+        count++;
+        if(count > peak)
+            peak = count;
+
+        return new (p) T(std::forward<Args>(args)...);
+    }
+
+    void reset() {
+        chunk = 0;
+        used = 0;
+        count = 0;
+    }
+
+    std::size_t size() const { return count; }
+    std::size_t peak_size() const { return peak; }
+    std::size_t bytes_used() const { return count * sizeof(T); }
+    std::size_t bytes_peak() const { return peak * sizeof(T); }
+    std::size_t bytes_reserved() const { return chunks.size() * chunk_size * sizeof(T); }
+
+private:
+    std::vector<std::unique_ptr<unsigned char[]>> chunks;
+    std::size_t chunk_size;
+    std::size_t chunk;
+    std::size_t used;
+    std::size_t count;
+    std::size_t peak;
+};
+
+#endif /* ARENA_H */
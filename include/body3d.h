@@ -1,13 +1,14 @@
 #ifndef BODY_H
 #define BODY_H
 
-#include "glad/glad.h"
-#include "GLFW/glfw3.h"
-
 #include <vector>
 #include <cmath>
 #include "glm/glm.hpp"
 
+//gravitational constant and softening length shared by every force path
+const double GRAVITY = 6.67e-11;
+const double SOFTENING = 3e4;
+
 class Body3D {
 public:
     glm::dvec3 position;
@@ -24,14 +25,14 @@ public:
         this->mass = mass;
     }
 
-    static Body3D* add(Body3D &a, Body3D &b) {
+    static Body3D add(const Body3D &a, const Body3D &b) {
         //return new Body3D(a.position + b.position, a.velocity + b.velocity, a.force + b.force, a.mass + b.mass);
         double m = a.mass + b.mass;
         double x = (a.position.x * a.mass + b.position.x * b.mass) / m;
         double y = (a.position.y * a.mass + b.position.y * b.mass) / m;
         double z = (a.position.z * a.mass + b.position.z * b.mass) / m;
 
-        return new Body3D(glm::dvec3(x, y, z), glm::dvec3(0.0f), glm::dvec3(0.0f), m);
+        return Body3D(glm::dvec3(x, y, z), glm::dvec3(0.0f), glm::dvec3(0.0f), m);
     }
 
     double distance_to(Body3D &b) {
@@ -54,14 +55,30 @@ public:
     }
 
     void add_force(Body3D &b) {
-        double G = 6.67e-11;
-        double eps = 3e4;
-        glm::dvec3 delta = b.position - position;
+        add_force(b.position, b.mass);
+    }
+
+    //pull of a point mass, used for tree nodes that aren't backed by a Body3D
+    void add_force(const glm::dvec3 &p, double m) {
+        double G = GRAVITY;
+        double eps = SOFTENING;
+        glm::dvec3 delta = p - position;
         double distance = std::sqrt(delta.x*delta.x + delta.y*delta.y + delta.z*delta.z);
-        double F = (G * mass * b.mass) / (distance*distance + eps*eps);
+        double F = (G * mass * m) / (distance*distance + eps*eps);
         force += F * delta / distance;
     }
 
+    //acceleration at p caused by a point mass m at q, add_force divided by the mass at p.
+    //a mass sitting exactly on p has no direction to pull in and contributes nothing
+    static glm::dvec3 acceleration(const glm::dvec3 &p, const glm::dvec3 &q, double m) {
+        glm::dvec3 delta = q - p;
+        double distance = std::sqrt(delta.x*delta.x + delta.y*delta.y + delta.z*delta.z);
+        if(distance == 0.0)
+            return glm::dvec3(0.0);
+        double a = (GRAVITY * m) / (distance*distance + SOFTENING*SOFTENING);
+        return a * delta / distance;
+    }
+
     bool operator == (const Body3D &b) const {
         return  (position == b.position) &&
                 (velocity == b.velocity) &&
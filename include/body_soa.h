@@ -0,0 +1,148 @@
+#ifndef BODY_SOA_H
+#define BODY_SOA_H
+
+#include <vector>
+#include <array>
+#include <new>
+#include <cstddef>
+
+#include "glm/glm.hpp"
+#include "body3d.h"
+
+//alignment of every BodySoA array, one cache line / one AVX-512 register
+const std::size_t SOA_ALIGN = 64;
+
+template <typename T, std::size_t Align>
+struct AlignedAllocator {
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind { typedef AlignedAllocator<U, Align> other; };
+
+    AlignedAllocator() {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+
+    void deallocate(T *p, std::size_t) {
+        ::operator delete(p, std::align_val_t(Align));
+    }
+
+    bool operator == (const AlignedAllocator&) const { return true; }
+    bool operator != (const AlignedAllocator&) const { return false; }
+};
+
+//bodies stored as one array per component so force walks only pull
+//positions and masses through the cache and the integrate loop vectorizes.
+//a/ax/ay/az hold acceleration (force / mass), not force.
+//get/set/operator[]/push_back convert to and from Body3D for code that still wants one
+class BodySoA {
+public:
+    typedef std::vector<double, AlignedAllocator<double, SOA_ALIGN>> Array;
+
+    Array x, y, z;
+    Array vx, vy, vz;
+    Array ax, ay, az;
+    Array mass;
+
+    std::size_t size() const { return mass.size(); }
+    bool empty() const { return mass.empty(); }
+
+    void reserve(std::size_t n) {
+        for(Array *a : arrays())
+            a->reserve(n);
+    }
+
+    void resize(std::size_t n) {
+        for(Array *a : arrays())
+            a->resize(n, 0.0);
+    }
+
+    void clear() {
+        for(Array *a : arrays())
+            a->clear();
+    }
+
+    void push_back(const Body3D &b) {
+        x.push_back(b.position.x);
+        y.push_back(b.position.y);
+        z.push_back(b.position.z);
+        vx.push_back(b.velocity.x);
+        vy.push_back(b.velocity.y);
+        vz.push_back(b.velocity.z);
+        ax.push_back(b.force.x / b.mass);
+        ay.push_back(b.force.y / b.mass);
+        az.push_back(b.force.z / b.mass);
+        mass.push_back(b.mass);
+    }
+
+    glm::dvec3 position(std::size_t i) const {
+        return glm::dvec3(x[i], y[i], z[i]);
+    }
+
+    glm::dvec3 velocity(std::size_t i) const {
+        return glm::dvec3(vx[i], vy[i], vz[i]);
+    }
+
+    glm::dvec3 acceleration(std::size_t i) const {
+        return glm::dvec3(ax[i], ay[i], az[i]);
+    }
+
+    Body3D get(std::size_t i) const {
+        return Body3D(position(i), velocity(i), acceleration(i) * mass[i], mass[i]);
+    }
+
+    //read only view, write back with set()
+    const Body3D operator [] (std::size_t i) const {
+        return get(i);
+    }
+
+    void set(std::size_t i, const Body3D &b) {
+        x[i] = b.position.x;
+        y[i] = b.position.y;
+        z[i] = b.position.z;
+        vx[i] = b.velocity.x;
+        vy[i] = b.velocity.y;
+        vz[i] = b.velocity.z;
+        ax[i] = b.force.x / b.mass;
+        ay[i] = b.force.y / b.mass;
+        az[i] = b.force.z / b.mass;
+        mass[i] = b.mass;
+    }
+
+    //drops every body with alive[i] false, the rest keep their order
+    void compact(const std::vector<bool> &alive) {
+        std::size_t n = 0;
+        for(std::size_t i = 0; i < size(); i++) {
+            if(!alive[i])
+                continue;
+            if(n != i)
+                for(Array *a : arrays())
+                    (*a)[n] = (*a)[i];
+            n++;
+        }
+        resize(n);
+    }
+
+    void to_aos(std::vector<Body3D> &out) const {
+        out.resize(size());
+        for(std::size_t i = 0; i < size(); i++)
+            out[i] = get(i);
+    }
+
+    void from_aos(const std::vector<Body3D> &in) {
+        resize(in.size());
+        for(std::size_t i = 0; i < in.size(); i++)
+            set(i, in[i]);
+    }
+
+private:
+    std::array<Array*, 10> arrays() {
+        return {&x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &mass};
+    }
+};
+
+#endif /* BODY_SOA_H */
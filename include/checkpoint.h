@@ -0,0 +1,365 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "universe.h"
+
+//on disk layout, all little endian as written by the machine that saved it:
+//one CHECKPOINT_ALIGN sized block holding the header, then the ten BodySoA
+//arrays as raw doubles in x y z vx vy vz ax ay az mass order, each starting
+//on a CHECKPOINT_ALIGN boundary. a mapped file is already the arrays, a
+//load is validation plus one memcpy per array
+const uint32_t CHECKPOINT_VERSION = 2;
+const uint32_t CHECKPOINT_ENDIAN = 0x01020304;
+const uint64_t CHECKPOINT_ALIGN = 4096;     //page size, so mapped arrays are page and SIMD aligned
+const int CHECKPOINT_ARRAYS = 10;
+const char CHECKPOINT_MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'C', 'K', 'P'};
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;            //CHECKPOINT_ENDIAN in the writer's byte order
+    uint64_t header_size;       //sizeof(CheckpointHeader) of the writer
+    uint64_t file_size;
+    uint64_t count;             //bodies
+    uint64_t offsets[CHECKPOINT_ARRAYS];
+
+    //run state
+    uint64_t step_count;
+    double sim_time;
+    uint64_t seed;
+    uint64_t merged_bodies;
+
+    //solver parameters, enums as int32
+    double size;
+    int32_t solver, builder;
+    double theta, fmm_theta;
+    uint32_t group_size, leaf_size, fmm_leaf_size;
+    uint32_t pm_grid;
+    int32_t pm_assignment;
+    uint32_t pm_periodic;
+    double split_scale;
+    uint32_t dynamic_bounds, refit_tree;
+    double refit_threshold;
+    uint32_t block_timesteps, max_rung;
+    double eta;
+    uint32_t merge_collisions;
+    int32_t expansion;
+    double collision_radius;
+    char integrator[16];        //Integrator::name()
+};
+
+static_assert(sizeof(CheckpointHeader) <= CHECKPOINT_ALIGN, "checkpoint header must fit its block");
+
+inline uint64_t checkpoint_round_up(uint64_t bytes) {
+    return (bytes + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+}
+
+//header describing uni as it is now, offsets laid out for uni.bodies.size() bodies
+inline CheckpointHeader checkpoint_header(const Universe &uni) {
+    CheckpointHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    h.version = CHECKPOINT_VERSION;
+    h.endian = CHECKPOINT_ENDIAN;
+    h.header_size = sizeof(CheckpointHeader);
+    h.count = uni.bodies.size();
+
+    uint64_t offset = CHECKPOINT_ALIGN;
+    for(int a = 0; a < CHECKPOINT_ARRAYS; a++) {
+        h.offsets[a] = offset;
+        offset += checkpoint_round_up(h.count * sizeof(double));
+    }
+    h.file_size = offset;
+
+    h.step_count = uni.step_count;
+    h.sim_time = uni.sim_time;
+    h.seed = uni.seed;
+    h.merged_bodies = uni.merged_bodies;
+
+    h.size = uni.size;
+    h.solver = uni.solver;
+    h.builder = uni.builder;
+    h.theta = uni.linear_tree.theta;
+    h.expansion = uni.linear_tree.expansion;
+    h.fmm_theta = uni.fmm.theta;
+    h.group_size = uni.linear_tree.group_size;
+    h.leaf_size = uni.linear_tree.leaf_size;
+    h.fmm_leaf_size = uni.fmm.leaf_size;
+    h.pm_grid = uni.pm.grid();
+    h.pm_assignment = uni.pm.assignment;
+    h.pm_periodic = uni.pm.periodic;
+    h.split_scale = uni.split_scale;
+    h.dynamic_bounds = uni.dynamic_bounds;
+    h.refit_tree = uni.refit_tree;
+    h.refit_threshold = uni.refit_threshold;
+    h.block_timesteps = uni.block_timesteps;
+    h.max_rung = uni.max_rung;
+    h.eta = uni.eta;
+    h.merge_collisions = uni.merge_collisions;
+    h.collision_radius = uni.collision_radius;
+    std::strncpy(h.integrator, uni.integrator->name(), sizeof(h.integrator) - 1);
+    return h;
+}
+
+//writes checkpoints on a thread of its own. start() copies the bodies and
+//returns, so the step loop only pays for one memcpy of the arrays. the file
+//is written next to path and renamed over it once complete, a crash mid
+//write leaves the previous checkpoint intact. one write is in flight at a
+//time, start() waits for the last one first. a failed write is sticky, every
+//later start() and wait() returns false so it can't be lost
+class CheckpointWriter {
+public:
+    std::string error;          //why the first failed write failed, empty if none did
+
+    CheckpointWriter() {
+        this->writing = false;
+        this->ok = true;
+    }
+
+    ~CheckpointWriter() {
+        wait();
+    }
+
+    //false without starting anything when an earlier write failed
+    bool start(const Universe &uni, const std::string &path) {
+        if(!wait())
+            return false;
+
+        header = checkpoint_header(uni);
+        this->path = path;
+        //vector assignment keeps the capacity of the last snapshot
+        snapshot = uni.bodies;
+
+        writing = true;
+        thread = std::thread(&CheckpointWriter::run, this);
+        return true;
+    }
+
+    //blocks until the write in flight is done, false if it or an earlier one failed
+    bool wait() {
+        if(thread.joinable())
+            thread.join();
+        return ok;
+    }
+
+    bool busy() const {
+        return writing;
+    }
+
+private:
+    std::thread thread;
+    std::atomic<bool> writing;
+    bool ok;
+    std::string path;
+    CheckpointHeader header;
+    BodySoA snapshot;
+
+    void fail(const std::string &message, FILE *file, const std::string &tmp) {
+        error = message + ": " + tmp;
+        ok = false;
+        if(file)
+            fclose(file);
+        remove(tmp.c_str());
+    }
+
+    void run() {
+        std::string tmp = path + ".tmp";
+        FILE *file = fopen(tmp.c_str(), "wb");
+        if(!file) {
+            fail("can't open checkpoint", NULL, tmp);
+            writing = false;
+            return;
+        }
+
+        const BodySoA::Array *arrays[CHECKPOINT_ARRAYS] = {
+            &snapshot.x, &snapshot.y, &snapshot.z, &snapshot.vx, &snapshot.vy, &snapshot.vz,
+            &snapshot.ax, &snapshot.ay, &snapshot.az, &snapshot.mass
+        };
+        std::vector<char> zeros(CHECKPOINT_ALIGN, 0);
+
+        bool good = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                    fwrite(zeros.data(), CHECKPOINT_ALIGN - sizeof(header), 1, file) == 1;
+        for(int a = 0; a < CHECKPOINT_ARRAYS && good; a++) {
+            size_t bytes = header.count * sizeof(double);
+            size_t pad = checkpoint_round_up(bytes) - bytes;
+            if(bytes > 0)
+                good = fwrite(arrays[a]->data(), bytes, 1, file) == 1;
+            if(good && pad > 0)
+                good = fwrite(zeros.data(), pad, 1, file) == 1;
+        }
+
+        if(!good) {
+            fail("can't write checkpoint", file, tmp);
+        }
+        else if(fclose(file) != 0) {
+            fail("can't write checkpoint", NULL, tmp);
+        }
+        else if(rename(tmp.c_str(), path.c_str()) != 0) {
+            fail("can't rename checkpoint", NULL, tmp);
+        }
+        else {
+            error.clear();
+        }
+        writing = false;
+    }
+};
+
+//restores bodies, run state and solver parameters from a checkpoint written
+//by CheckpointWriter. the file is mapped and the arrays are copied straight
+//out of the mapping on the pool, nothing is parsed. the integrator starts
+//from fresh forces like after any other edit of the bodies. returns false
+//and leaves uni untouched when the file is missing, truncated or from an
+//incompatible build
+inline bool load_checkpoint(Universe &uni, const std::string &path, std::string &error) {
+    const char *data = NULL;
+    size_t length = 0;
+
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        error = "can't open checkpoint: " + path;
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CheckpointHeader)) {
+        close(fd);
+        error = "checkpoint too short: " + path;
+        return false;
+    }
+    length = st.st_size;
+    void *mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED) {
+        error = "can't map checkpoint: " + path;
+        return false;
+    }
+    madvise(mapped, length, MADV_SEQUENTIAL | MADV_WILLNEED);
+    data = (const char*)mapped;
+#else
+    //no mmap on the windows build, read the whole file into memory instead
+    std::vector<char> contents;
+    FILE *file = fopen(path.c_str(), "rb");
+    if(!file) {
+        error = "can't open checkpoint: " + path;
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    contents.resize(ftell(file));
+    fseek(file, 0, SEEK_SET);
+    bool read = contents.empty() || fread(contents.data(), contents.size(), 1, file) == 1;
+    fclose(file);
+    if(!read || contents.size() < sizeof(CheckpointHeader)) {
+        error = "checkpoint too short: " + path;
+        return false;
+    }
+    data = contents.data();
+    length = contents.size();
+#endif
+
+    CheckpointHeader h;
+    std::memcpy(&h, data, sizeof(h));
+
+    error.clear();
+    if(std::memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0)
+        error = "not a checkpoint: " + path;
+    else if(h.version != CHECKPOINT_VERSION || h.header_size != sizeof(CheckpointHeader))
+        error = "unsupported checkpoint version: " + path;
+    else if(h.endian != CHECKPOINT_ENDIAN)
+        error = "checkpoint has the wrong byte order: " + path;
+    else if(h.file_size != length)
+        error = "checkpoint truncated: " + path;
+    else {
+        for(int a = 0; a < CHECKPOINT_ARRAYS; a++)
+            if(h.offsets[a] % CHECKPOINT_ALIGN != 0 || h.offsets[a] > length ||
+               h.count > (length - h.offsets[a]) / sizeof(double))
+                error = "checkpoint arrays out of bounds: " + path;
+        if(error.empty() && !PmSolver::valid_grid(h.pm_grid))
+            error = "checkpoint has a PM grid that isn't a power of two: " + path;
+        if(error.empty() && (h.solver < BARNES_HUT || h.solver > TREE_PM ||
+                             h.builder < POINTER_TREE || h.builder > LINEAR_TREE ||
+                             h.pm_assignment < CIC || h.pm_assignment > TSC ||
+                             h.expansion < MONOPOLE || h.expansion > QUADRUPOLE))
+            error = "checkpoint has an unknown solver, tree, mass assignment or expansion: " + path;
+    }
+
+    if(!error.empty()) {
+#ifndef _WIN32
+        munmap((void*)data, length);
+#endif
+        return false;
+    }
+
+    BodySoA &bodies = uni.bodies;
+    bodies.resize(h.count);
+    BodySoA::Array *arrays[CHECKPOINT_ARRAYS] = {
+        &bodies.x, &bodies.y, &bodies.z, &bodies.vx, &bodies.vy, &bodies.vz,
+        &bodies.ax, &bodies.ay, &bodies.az, &bodies.mass
+    };
+
+    //blocks of every array copy independently, the mapping faults in in parallel
+    const size_t block = 1 << 16;
+    size_t blocks = (h.count + block - 1) / block;
+    uni.pool.parallel_for(0, CHECKPOINT_ARRAYS * blocks, 1, [&](size_t k) {
+        size_t a = k / blocks;
+        size_t begin = (k % blocks) * block;
+        size_t end = std::min<size_t>(begin + block, h.count);
+        std::memcpy(arrays[a]->data() + begin, data + h.offsets[a] + begin * sizeof(double),
+                    (end - begin) * sizeof(double));
+    });
+
+#ifndef _WIN32
+    munmap((void*)data, length);
+#endif
+
+    uni.num_bodies = h.count;
+    uni.step_count = h.step_count;
+    uni.sim_time = h.sim_time;
+    uni.seed = h.seed;
+    uni.merged_bodies = h.merged_bodies;
+
+    uni.size = h.size;
+    uni.solver = (ForceSolver)h.solver;
+    uni.builder = (TreeBuilder)h.builder;
+    uni.linear_tree.theta = h.theta;
+    uni.linear_tree.expansion = (MultipoleOrder)h.expansion;
+    uni.fmm.theta = h.fmm_theta;
+    uni.linear_tree.group_size = h.group_size;
+    uni.linear_tree.leaf_size = h.leaf_size;
+    uni.fmm.leaf_size = h.fmm_leaf_size;
+    uni.pm.set_grid(h.pm_grid);
+    uni.pm.assignment = (MassAssignment)h.pm_assignment;
+    uni.pm.periodic = h.pm_periodic != 0;
+    uni.split_scale = h.split_scale;
+    uni.dynamic_bounds = h.dynamic_bounds != 0;
+    uni.refit_tree = h.refit_tree != 0;
+    uni.refit_threshold = h.refit_threshold;
+    uni.block_timesteps = h.block_timesteps != 0;
+    uni.max_rung = h.max_rung;
+    uni.eta = h.eta;
+    uni.merge_collisions = h.merge_collisions != 0;
+    uni.collision_radius = h.collision_radius;
+
+    h.integrator[sizeof(h.integrator) - 1] = '\0';
+    uni.set_integrator(make_integrator(h.integrator));
+    uni.bodies_changed();
+    return true;
+}
+
+#endif /* CHECKPOINT_H */
@@ -0,0 +1,80 @@
+#ifndef DIRECT_H
+#define DIRECT_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "glm/glm.hpp"
+#include "body_soa.h"
+#include "gravity_kernel.h"
+#include "thread_pool.h"
+
+//relative acceleration error |a - a_ref| / |a_ref| over a sample of bodies
+struct ForceError {
+    size_t count;
+    double rms;
+    double median;
+    double p99;
+    double max;
+};
+
+//exact O(N^2) accelerations for a sample of bodies, the reference the tree
+//solvers are measured against. each sampled body streams every position
+//and mass straight out of the BodySoA arrays through the SIMD gravity kernel
+class DirectSolver {
+public:
+    std::vector<unsigned int> sample;   //indices into bodies
+    std::vector<glm::dvec3> acc;        //exact acceleration of sample[k]
+
+    //count bodies spread evenly over the index range, all of them when count
+    //is 0 or not smaller than n
+    void pick_sample(size_t n, size_t count) {
+        sample.clear();
+        if(count == 0 || count >= n) {
+            for(size_t i = 0; i < n; i++)
+                sample.push_back(i);
+            return;
+        }
+        for(size_t k = 0; k < count; k++)
+            sample.push_back(k * n / count);
+    }
+
+    void evaluate(const BodySoA &bodies, ThreadPool &pool) {
+        acc.resize(sample.size());
+        GravityKernelFn kernel = gravity_kernel();
+        pool.parallel_for(0, sample.size(), 1, [&](size_t k) {
+            glm::dvec3 a(0.0f);
+            //the body itself sits at r = 0, which every kernel skips
+            kernel(bodies.position(sample[k]), bodies.x.data(), bodies.y.data(), bodies.z.data(),
+                   bodies.mass.data(), bodies.size(), a);
+            acc[k] = a;
+        });
+    }
+
+    //error of the accelerations currently stored in bodies against the last evaluate
+    ForceError compare(const BodySoA &bodies) const {
+        std::vector<double> errors(sample.size());
+        for(size_t k = 0; k < sample.size(); k++) {
+            double ref = glm::length(acc[k]);
+            double diff = glm::length(bodies.acceleration(sample[k]) - acc[k]);
+            errors[k] = (ref > 0.0) ? diff / ref : diff;
+        }
+        std::sort(errors.begin(), errors.end());
+
+        ForceError e = {errors.size(), 0.0, 0.0, 0.0, 0.0};
+        if(errors.empty())
+            return e;
+
+        double sum = 0.0;
+        for(double x : errors)
+            sum += x * x;
+        e.rms = std::sqrt(sum / errors.size());
+        e.median = errors[errors.size() / 2];
+        e.p99 = errors[std::min(errors.size() - 1, errors.size() * 99 / 100)];
+        e.max = errors.back();
+        return e;
+    }
+};
+
+#endif /* DIRECT_H */
@@ -0,0 +1,137 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <cstddef>
+
+#include "thread_pool.h"
+
+typedef std::complex<double> Complex;
+
+//the only lengths Fft1D can transform
+inline bool is_power_of_two(std::size_t n) {
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+//in place radix-2 transform of a power of two length, twiddles and the bit
+//reversal table are built once per size
+class Fft1D {
+public:
+    Fft1D(std::size_t n = 0) {
+        init(n);
+    }
+
+    void init(std::size_t n) {
+        this->n = n;
+        reversed.resize(n);
+        twiddles.resize(n / 2);
+
+        int bits = 0;
+        while(((std::size_t)1 << bits) < n)
+            bits++;
+        for(std::size_t i = 0; i < n; i++) {
+            std::size_t r = 0;
+            for(int b = 0; b < bits; b++)
+                if(i & ((std::size_t)1 << b))
+                    r |= (std::size_t)1 << (bits - 1 - b);
+            reversed[i] = r;
+        }
+        for(std::size_t i = 0; i < n / 2; i++)
+            twiddles[i] = std::polar(1.0, -2.0 * M_PI * i / n);
+    }
+
+    std::size_t size() const { return n; }
+
+    //unnormalized, inverse = true conjugates the twiddles
+    void transform(Complex *data, bool inverse) const {
+        for(std::size_t i = 0; i < n; i++)
+            if(i < reversed[i])
+                std::swap(data[i], data[reversed[i]]);
+
+        for(std::size_t len = 2; len <= n; len <<= 1) {
+            std::size_t half = len / 2;
+            std::size_t step = n / len;
+            for(std::size_t i = 0; i < n; i += len) {
+                for(std::size_t j = 0; j < half; j++) {
+                    Complex w = inverse ? std::conj(twiddles[j * step]) : twiddles[j * step];
+                    Complex u = data[i + j];
+                    Complex v = data[i + j + half] * w;
+                    data[i + j] = u + v;
+                    data[i + j + half] = u - v;
+                }
+            }
+        }
+    }
+
+private:
+    std::size_t n;
+    std::vector<std::size_t> reversed;
+    std::vector<Complex> twiddles;
+};
+
+//cubic n^3 grid, x fastest. the 3d transform is a 1d transform along every
+//line of each axis, lines are independent and spread over the pool
+class Fft3D {
+public:
+    std::size_t n;
+    std::vector<Complex> data;
+
+    Fft3D() {
+        this->n = 0;
+    }
+
+    void resize(std::size_t n) {
+        if(this->n == n)
+            return;
+        this->n = n;
+        data.assign(n * n * n, Complex(0.0, 0.0));
+        line.init(n);
+    }
+
+    Complex& at(std::size_t x, std::size_t y, std::size_t z) {
+        return data[(z * n + y) * n + x];
+    }
+
+    void forward(ThreadPool &pool) {
+        transform(pool, false);
+    }
+
+    //includes the 1/n^3 normalization
+    void inverse(ThreadPool &pool) {
+        transform(pool, true);
+        double scale = 1.0 / ((double)n * n * n);
+        pool.parallel_for(0, data.size(), 1 << 15, [&](std::size_t i) {
+            data[i] *= scale;
+        });
+    }
+
+private:
+    Fft1D line;
+
+    void transform(ThreadPool &pool, bool inverse) {
+        std::size_t strides[3] = {1, n, n * n};
+
+        for(int axis = 0; axis < 3; axis++) {
+            std::size_t stride = strides[axis];
+            //the two axes that aren't transformed pick the line
+            std::size_t s1 = strides[(axis + 1) % 3];
+            std::size_t s2 = strides[(axis + 2) % 3];
+
+            pool.parallel_for(0, n * n, 16, [&](std::size_t k) {
+                static thread_local std::vector<Complex> buffer;
+                buffer.resize(n);
+
+                std::size_t base = (k % n) * s1 + (k / n) * s2;
+                for(std::size_t i = 0; i < n; i++)
+                    buffer[i] = data[base + i * stride];
+                line.transform(buffer.data(), inverse);
+                for(std::size_t i = 0; i < n; i++)
+                    data[base + i * stride] = buffer[i];
+            });
+        }
+    }
+};
+
+#endif /* FFT_H */
@@ -0,0 +1,314 @@
+#ifndef FMM_H
+#define FMM_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "glm/glm.hpp"
+#include "body3d.h"
+#include "body_soa.h"
+#include "gravity_kernel.h"
+#include "linear_octree.h"
+#include "thread_pool.h"
+
+//local expansion of the far field around a node's com to second order:
+//acceleration, its gradient t (tidal tensor) xx yy zz xy xz yz and its
+//second derivative h, fully symmetric, xxx yyy zzz xxy xxz xyy yyz xzz yzz xyz
+struct FmmLocal {
+    glm::dvec3 a;
+    double t[6];
+    double h[10];
+};
+
+//fast multipole evaluation on top of a built LinearOctree. sources are
+//monopoles plus quadrupoles about their com, the monopole part softened the
+//same way as the direct sum. the tree is cut into disjoint sink subtrees and
+//each one is walked against the whole tree from the root: well separated
+//pairs go through a cell to cell (M2L) translation into the sink's local
+//expansion, close leaf pairs are summed directly. locals are then pushed
+//down (L2L) and evaluated at the bodies (L2P). the walk is one sided, a pair
+//only updates its sink and the levels above the sinks are revisited by every
+//sink, so on top of the cell pairs there is O(S log N) work for S sink
+//subtrees. this is not a symmetric dual tree traversal and not strictly O(N).
+//the error of an accepted pair falls as theta^3, which is what lets it run at
+//a much wider theta than the barnes hut walk for the same rms error
+class FmmSolver {
+public:
+    double theta;               //cells interact when (r_a + r_b) < theta * distance
+    unsigned int leaf_size;     //nodes with at most this many bodies are summed directly
+
+    std::vector<glm::dvec3> acc;    //acceleration per body in the tree's morton order
+
+    FmmSolver() {
+        this->theta = 0.8;
+        this->leaf_size = 16;
+        this->tree = NULL;
+    }
+
+    void evaluate(const LinearOctree &tree, ThreadPool &pool) {
+        this->tree = &tree;
+        const std::vector<LinearNode> &nodes = tree.nodes;
+        const std::vector<glm::dvec4> &points = tree.points;
+
+        acc.assign(points.size(), glm::dvec3(0.0f));
+        locals.resize(nodes.size());
+        for(size_t i = 0; i < nodes.size(); i++) {
+            locals[i].a = glm::dvec3(0.0f);
+            std::fill(locals[i].t, locals[i].t + 6, 0.0);
+            std::fill(locals[i].h, locals[i].h + 10, 0.0);
+        }
+
+        //the direct sums run the gravity kernel straight over these
+        px.resize(points.size());
+        py.resize(points.size());
+        pz.resize(points.size());
+        pm.resize(points.size());
+        for(size_t j = 0; j < points.size(); j++) {
+            px[j] = points[j].x;
+            py[j] = points[j].y;
+            pz[j] = points[j].z;
+            pm[j] = points[j].w;
+        }
+
+        //radius of the sphere around the com that holds every body of the node
+        //and the quadrupole about the com, children come after their parent in
+        //preorder so walk backwards
+        radius.resize(nodes.size());
+        quad.assign(6 * nodes.size(), 0.0);
+        for(size_t i = nodes.size(); i-- > 0;) {
+            const LinearNode &n = nodes[i];
+            double *q = &quad[6 * i];
+            double r = 0.0;
+            if(n.next == i + 1) {
+                for(unsigned int j = n.first; j < n.first + n.count; j++) {
+                    glm::dvec3 d = glm::dvec3(points[j]) - n.com;
+                    r = std::max(r, glm::length(d));
+                    LinearOctree::add_quadrupole(q, d, points[j].w);
+                }
+            }
+            else {
+                for(unsigned int c = i + 1; c < n.next; c = nodes[c].next) {
+                    glm::dvec3 d = nodes[c].com - n.com;
+                    r = std::max(r, glm::length(d) + radius[c]);
+                    for(int k = 0; k < 6; k++)
+                        q[k] += quad[6 * c + k];
+                    LinearOctree::add_quadrupole(q, d, nodes[c].mass);
+                }
+            }
+            //never looser than the cube itself
+            radius[i] = std::min(r, glm::length(n.com - n.center) + std::sqrt(3.0) * n.length);
+        }
+
+        if(nodes.empty())
+            return;
+
+        //disjoint sink subtrees, each one only writes to its own locals and bodies.
+        //where a sink starts changes the interaction lists, so the cutoff only
+        //depends on the tree and the forces don't depend on the thread count.
+        //smaller sinks repeat the walk above them more often, larger ones give
+        //the pool too few tasks, the cost is flat between about 16 and 128 leaves
+        size_t cutoff = (size_t)leaf_size * 32;
+        sinks.clear();
+        unsigned int i = 0;
+        while(i < nodes.size()) {
+            if(nodes[i].count <= cutoff || is_leaf(i)) {
+                sinks.push_back(i);
+                i = nodes[i].next;
+            }
+            else {
+                i++;
+            }
+        }
+
+        pool.parallel_for(0, sinks.size(), 1, [&](size_t k) {
+            interact(sinks[k], 0);
+            downward(sinks[k]);
+        });
+    }
+
+private:
+    const LinearOctree *tree;
+    std::vector<FmmLocal> locals;
+    std::vector<double> radius;
+    std::vector<double> quad;       //6 per node, same layout as LinearNode::quad
+    std::vector<unsigned int> sinks;
+    BodySoA::Array px, py, pz, pm;
+
+    bool is_leaf(unsigned int i) const {
+        const LinearNode &n = tree->nodes[i];
+        return n.next == i + 1 || n.count <= leaf_size;
+    }
+
+    //adds everything b exerts on the bodies of a
+    void interact(unsigned int a, unsigned int b) {
+        const std::vector<LinearNode> &nodes = tree->nodes;
+
+        if(a == b) {
+            if(is_leaf(a)) {
+                direct(a, b);
+                return;
+            }
+            for(unsigned int ca = a + 1; ca < nodes[a].next; ca = nodes[ca].next)
+                for(unsigned int cb = a + 1; cb < nodes[a].next; cb = nodes[cb].next)
+                    interact(ca, cb);
+            return;
+        }
+
+        glm::dvec3 s = nodes[a].com - nodes[b].com;
+        double reach = radius[a] + radius[b];
+        if(reach * reach < theta * theta * glm::dot(s, s)) {
+            translate(a, b);
+            return;
+        }
+
+        bool leaf_a = is_leaf(a);
+        bool leaf_b = is_leaf(b);
+        if(leaf_a && leaf_b) {
+            direct(a, b);
+        }
+        else if(leaf_a || (!leaf_b && radius[b] >= radius[a])) {
+            for(unsigned int cb = b + 1; cb < nodes[b].next; cb = nodes[cb].next)
+                interact(a, cb);
+        }
+        else {
+            for(unsigned int ca = a + 1; ca < nodes[a].next; ca = nodes[ca].next)
+                interact(ca, b);
+        }
+    }
+
+    //P2P, bodies of b on bodies of a through the dispatched kernel. when
+    //a == b the body itself is in the range, the kernels skip r == 0
+    void direct(unsigned int a, unsigned int b) {
+        const LinearNode &na = tree->nodes[a];
+        const LinearNode &nb = tree->nodes[b];
+        const std::vector<glm::dvec4> &points = tree->points;
+        GravityKernelFn kernel = gravity_kernel();
+
+        for(unsigned int i = na.first; i < na.first + na.count; i++)
+            kernel(glm::dvec3(points[i]), px.data() + nb.first, py.data() + nb.first, pz.data() + nb.first,
+                   pm.data() + nb.first, nb.count, acc[i]);
+    }
+
+    //M2L, the multipole of b expanded to second order around the com of a
+    void translate(unsigned int a, unsigned int b) {
+        const LinearNode &na = tree->nodes[a];
+        const LinearNode &nb = tree->nodes[b];
+        FmmLocal &l = locals[a];
+
+        //monopole with the direct sum's softening, a = G m s f(|s|) with
+        //f = 1 / ((s^2 + eps^2) s) and s from the sink to the source. the
+        //derivatives along the sink position come from u = f' / s, w = u' / s.
+        //one square root and one division for the whole translation
+        glm::dvec3 s = nb.com - na.com;
+        double s2 = s.x*s.x + s.y*s.y + s.z*s.z;
+        double r = std::sqrt(s2);
+        double soft = s2 + SOFTENING * SOFTENING;
+        double f = 1.0 / (soft * r);
+        double inv_r = soft * f;
+        double inv_r2 = inv_r * inv_r;
+        double d1 = 3.0 * s2 + SOFTENING * SOFTENING;
+        double f1 = -d1 * f * f;
+        double f2 = (2.0 * d1 * d1 * f - 6.0 * r) * f * f;
+        double u = f1 * inv_r;
+        double w = (f2 - u) * inv_r2;
+
+        double gm = GRAVITY * nb.mass;
+        double gf = gm * f, gu = gm * u, gw = gm * w;
+
+        l.a += gf * s;
+        l.t[0] -= gf + gu * s.x*s.x;
+        l.t[1] -= gf + gu * s.y*s.y;
+        l.t[2] -= gf + gu * s.z*s.z;
+        l.t[3] -= gu * s.x*s.y;
+        l.t[4] -= gu * s.x*s.z;
+        l.t[5] -= gu * s.y*s.z;
+        l.h[0] += s.x * (3.0 * gu + gw * s.x*s.x);
+        l.h[1] += s.y * (3.0 * gu + gw * s.y*s.y);
+        l.h[2] += s.z * (3.0 * gu + gw * s.z*s.z);
+        l.h[3] += s.y * (gu + gw * s.x*s.x);
+        l.h[4] += s.z * (gu + gw * s.x*s.x);
+        l.h[5] += s.x * (gu + gw * s.y*s.y);
+        l.h[6] += s.z * (gu + gw * s.y*s.y);
+        l.h[7] += s.x * (gu + gw * s.z*s.z);
+        l.h[8] += s.y * (gu + gw * s.z*s.z);
+        l.h[9] += gw * s.x*s.y*s.z;
+
+        //quadrupole of b into the acceleration and its gradient, newtonian
+        //like LinearOctree::quadrupole_acceleration, r points from b to a
+        const double *q = &quad[6 * b];
+        glm::dvec3 d = -s;
+        double inv_r5 = inv_r2 * inv_r2 * inv_r;
+        double inv_r7 = inv_r5 * inv_r2;
+        glm::dvec3 qd = apply(q, d);
+        double dqd = glm::dot(d, qd);
+
+        l.a += GRAVITY * inv_r5 * (qd - 2.5 * dqd * inv_r2 * d);
+
+        double g5 = GRAVITY * inv_r5;
+        double g7 = 5.0 * GRAVITY * inv_r7;
+        double gd = 2.5 * GRAVITY * dqd * inv_r7;
+        double gdd = 17.5 * GRAVITY * dqd * inv_r7 * inv_r2;
+        l.t[0] += g5 * q[0] - 2.0 * g7 * qd.x*d.x - gd + gdd * d.x*d.x;
+        l.t[1] += g5 * q[1] - 2.0 * g7 * qd.y*d.y - gd + gdd * d.y*d.y;
+        l.t[2] += g5 * q[2] - 2.0 * g7 * qd.z*d.z - gd + gdd * d.z*d.z;
+        l.t[3] += g5 * q[3] - g7 * (qd.x*d.y + qd.y*d.x) + gdd * d.x*d.y;
+        l.t[4] += g5 * q[4] - g7 * (qd.x*d.z + qd.z*d.x) + gdd * d.x*d.z;
+        l.t[5] += g5 * q[5] - g7 * (qd.y*d.z + qd.z*d.y) + gdd * d.y*d.z;
+    }
+
+    //symmetric tensor t times d
+    static glm::dvec3 apply(const double *t, const glm::dvec3 &d) {
+        return glm::dvec3(t[0]*d.x + t[3]*d.y + t[4]*d.z,
+                          t[3]*d.x + t[1]*d.y + t[5]*d.z,
+                          t[4]*d.x + t[5]*d.y + t[2]*d.z);
+    }
+
+    //h contracted once with d, a symmetric tensor in the layout of t
+    static void contract(const double *h, const glm::dvec3 &d, double *out) {
+        out[0] = h[0]*d.x + h[3]*d.y + h[4]*d.z;
+        out[1] = h[5]*d.x + h[1]*d.y + h[6]*d.z;
+        out[2] = h[7]*d.x + h[8]*d.y + h[2]*d.z;
+        out[3] = h[3]*d.x + h[5]*d.y + h[9]*d.z;
+        out[4] = h[4]*d.x + h[9]*d.y + h[7]*d.z;
+        out[5] = h[9]*d.x + h[6]*d.y + h[8]*d.z;
+    }
+
+    //the expansion l evaluated d away from its center
+    static glm::dvec3 expand(const FmmLocal &l, const glm::dvec3 &d, double *hd) {
+        contract(l.h, d, hd);
+        return l.a + apply(l.t, d) + 0.5 * apply(hd, d);
+    }
+
+    //L2L down the sink subtree in preorder, then L2P at the leaves
+    void downward(unsigned int sink) {
+        const std::vector<LinearNode> &nodes = tree->nodes;
+        const std::vector<glm::dvec4> &points = tree->points;
+        double hd[6];
+
+        unsigned int i = sink;
+        while(i < nodes[sink].next) {
+            const LinearNode &n = nodes[i];
+            const FmmLocal &l = locals[i];
+
+            if(is_leaf(i)) {
+                for(unsigned int j = n.first; j < n.first + n.count; j++)
+                    acc[j] += expand(l, glm::dvec3(points[j]) - n.com, hd);
+                i = n.next;
+                continue;
+            }
+
+            for(unsigned int c = i + 1; c < n.next; c = nodes[c].next) {
+                FmmLocal &lc = locals[c];
+                lc.a += expand(l, nodes[c].com - n.com, hd);
+                for(int k = 0; k < 6; k++)
+                    lc.t[k] += l.t[k] + hd[k];
+                for(int k = 0; k < 10; k++)
+                    lc.h[k] += l.h[k];
+            }
+            i++;
+        }
+    }
+};
+
+#endif /* FMM_H */
@@ -0,0 +1,232 @@
+#ifndef GRAVITY_KERNEL_H
+#define GRAVITY_KERNEL_H
+
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+
+#include "glm/glm.hpp"
+#include "body3d.h"
+#include "body_soa.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GRAVITY_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+//point masses one body interacts with (leaf bodies and accepted tree nodes),
+//collected during the walk and summed in one go by gravity_accumulate
+struct PointBatch {
+    BodySoA::Array x, y, z, m;
+    std::size_t count = 0;
+
+    std::size_t size() const { return count; }
+
+    void clear() {
+        count = 0;
+    }
+
+    //arrays only grow, so after the first few walks a push is four stores
+    void push(const glm::dvec3 &p, double mass) {
+        if(count == m.size()) {
+            std::size_t grown = std::max<std::size_t>(256, 2 * m.size());
+            x.resize(grown);
+            y.resize(grown);
+            z.resize(grown);
+            m.resize(grown);
+        }
+        x[count] = p.x;
+        y[count] = p.y;
+        z[count] = p.z;
+        m[count] = mass;
+        count++;
+    }
+};
+
+enum KernelISA {
+    KERNEL_SCALAR,
+    KERNEL_AVX2,
+    KERNEL_AVX512
+};
+
+//acceleration at p from n point masses, added to a. every version uses the
+//same formula as Body3D::acceleration and, like it, skips coincident points
+typedef void (*GravityKernelFn)(const glm::dvec3 &p, const double *x, const double *y, const double *z,
+                                const double *m, std::size_t n, glm::dvec3 &a);
+
+inline void gravity_scalar(const glm::dvec3 &p, const double *x, const double *y, const double *z,
+                           const double *m, std::size_t n, glm::dvec3 &a) {
+    const double eps2 = SOFTENING * SOFTENING;
+    for(std::size_t i = 0; i < n; i++) {
+        double dx = x[i] - p.x;
+        double dy = y[i] - p.y;
+        double dz = z[i] - p.z;
+        double r2 = dx*dx + dy*dy + dz*dz;
+        if(r2 == 0.0)
+            continue;
+        double f = (GRAVITY * m[i]) / ((r2 + eps2) * std::sqrt(r2));
+        a.x += f * dx;
+        a.y += f * dy;
+        a.z += f * dz;
+    }
+}
+
+#ifdef GRAVITY_KERNEL_X86
+
+__attribute__((target("avx2,fma")))
+inline double hsum_avx2(__m256d v) {
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx2,fma")))
+inline void gravity_avx2(const glm::dvec3 &p, const double *x, const double *y, const double *z,
+                         const double *m, std::size_t n, glm::dvec3 &a) {
+    const __m256d px = _mm256_set1_pd(p.x);
+    const __m256d py = _mm256_set1_pd(p.y);
+    const __m256d pz = _mm256_set1_pd(p.z);
+    const __m256d G = _mm256_set1_pd(GRAVITY);
+    const __m256d eps2 = _mm256_set1_pd(SOFTENING * SOFTENING);
+    const __m256d zero = _mm256_setzero_pd();
+
+    __m256d sx = zero, sy = zero, sz = zero;
+    std::size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + i), px);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + i), py);
+        __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(z + i), pz);
+        __m256d r2 = _mm256_fmadd_pd(dx, dx, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dz, dz)));
+        __m256d den = _mm256_mul_pd(_mm256_add_pd(r2, eps2), _mm256_sqrt_pd(r2));
+        __m256d f = _mm256_div_pd(_mm256_mul_pd(G, _mm256_loadu_pd(m + i)), den);
+        f = _mm256_and_pd(f, _mm256_cmp_pd(r2, zero, _CMP_GT_OQ));
+        sx = _mm256_fmadd_pd(f, dx, sx);
+        sy = _mm256_fmadd_pd(f, dy, sy);
+        sz = _mm256_fmadd_pd(f, dz, sz);
+    }
+
+    a.x += hsum_avx2(sx);
+    a.y += hsum_avx2(sy);
+    a.z += hsum_avx2(sz);
+    gravity_scalar(p, x + i, y + i, z + i, m + i, n - i, a);
+}
+
+//gcc's own _mm512_undefined_pd trips -Wuninitialized once inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+inline void gravity_avx512(const glm::dvec3 &p, const double *x, const double *y, const double *z,
+                           const double *m, std::size_t n, glm::dvec3 &a) {
+    const __m512d px = _mm512_set1_pd(p.x);
+    const __m512d py = _mm512_set1_pd(p.y);
+    const __m512d pz = _mm512_set1_pd(p.z);
+    const __m512d G = _mm512_set1_pd(GRAVITY);
+    const __m512d eps2 = _mm512_set1_pd(SOFTENING * SOFTENING);
+    const __m512d zero = _mm512_setzero_pd();
+
+    __m512d sx = zero, sy = zero, sz = zero;
+    std::size_t i = 0;
+    for(; i < n; i += 8) {
+        //the tail is a masked load, lanes past n and coincident points stay zero
+        __mmask8 live = (n - i >= 8) ? (__mmask8)0xff : (__mmask8)((1u << (n - i)) - 1);
+        __m512d dx = _mm512_sub_pd(_mm512_maskz_loadu_pd(live, x + i), px);
+        __m512d dy = _mm512_sub_pd(_mm512_maskz_loadu_pd(live, y + i), py);
+        __m512d dz = _mm512_sub_pd(_mm512_maskz_loadu_pd(live, z + i), pz);
+        __m512d r2 = _mm512_fmadd_pd(dx, dx, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dz, dz)));
+        live = _mm512_mask_cmp_pd_mask(live, r2, zero, _CMP_GT_OQ);
+        __m512d den = _mm512_mul_pd(_mm512_add_pd(r2, eps2), _mm512_sqrt_pd(r2));
+        __m512d f = _mm512_maskz_div_pd(live, _mm512_mul_pd(G, _mm512_maskz_loadu_pd(live, m + i)), den);
+        sx = _mm512_fmadd_pd(f, dx, sx);
+        sy = _mm512_fmadd_pd(f, dy, sy);
+        sz = _mm512_fmadd_pd(f, dz, sz);
+    }
+
+    a.x += _mm512_reduce_add_pd(sx);
+    a.y += _mm512_reduce_add_pd(sy);
+    a.z += _mm512_reduce_add_pd(sz);
+}
+
+#pragma GCC diagnostic pop
+
+#endif
+
+inline KernelISA detect_kernel_isa() {
+#ifdef GRAVITY_KERNEL_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return KERNEL_AVX512;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return KERNEL_AVX2;
+#endif
+    return KERNEL_SCALAR;
+}
+
+inline GravityKernelFn gravity_kernel_for(KernelISA isa) {
+#ifdef GRAVITY_KERNEL_X86
+    if(isa == KERNEL_AVX512)
+        return gravity_avx512;
+    if(isa == KERNEL_AVX2)
+        return gravity_avx2;
+#endif
+    return gravity_scalar;
+}
+
+//kernel in use, picked from the cpu on first use
+inline GravityKernelFn& gravity_kernel() {
+    static GravityKernelFn fn = gravity_kernel_for(detect_kernel_isa());
+    return fn;
+}
+
+//force a kernel for comparisons, asking for more than the cpu has falls back
+inline void set_gravity_kernel(KernelISA isa) {
+    if(isa > detect_kernel_isa())
+        isa = detect_kernel_isa();
+    gravity_kernel() = gravity_kernel_for(isa);
+}
+
+inline void gravity_accumulate(const glm::dvec3 &p, const PointBatch &batch, glm::dvec3 &a) {
+    gravity_kernel()(p, batch.x.data(), batch.y.data(), batch.z.data(), batch.m.data(), batch.size(), a);
+}
+
+//TreePM walks stop at SPLIT_CUTOFF * r_s, the short range force has fallen
+//to about 1.6% of newton there
+const double SPLIT_CUTOFF = 4.5;
+
+//share of the newtonian force at r left to the tree when the PM grid
+//carries -G erf(r / 2 r_s) / r: erfc(r / 2 r_s) + r / (r_s sqrt(pi)) exp(-r^2 / 4 r_s^2)
+inline double short_range_factor(double r, double split) {
+    double u = r / (2.0 * split);
+    return std::erfc(u) + (2.0 / std::sqrt(M_PI)) * u * std::exp(-u * u);
+}
+
+//gravity_accumulate with every term scaled by short_range_factor, erfc
+//doesn't vectorize so this one stays scalar
+inline void gravity_accumulate_short(const glm::dvec3 &p, const PointBatch &batch, double split, glm::dvec3 &a) {
+    const double eps2 = SOFTENING * SOFTENING;
+    for(std::size_t i = 0; i < batch.size(); i++) {
+        double dx = batch.x[i] - p.x;
+        double dy = batch.y[i] - p.y;
+        double dz = batch.z[i] - p.z;
+        double r2 = dx*dx + dy*dy + dz*dz;
+        if(r2 == 0.0)
+            continue;
+        double r = std::sqrt(r2);
+        double f = (GRAVITY * batch.m[i]) / ((r2 + eps2) * r) * short_range_factor(r, split);
+        a.x += f * dx;
+        a.y += f * dy;
+        a.z += f * dz;
+    }
+}
+
+//distance from p to the nearest point of the cube center +- length, 0 inside
+inline double cube_distance(const glm::dvec3 &p, const glm::dvec3 &center, double length) {
+    double dx = std::max(std::abs(p.x - center.x) - length, 0.0);
+    double dy = std::max(std::abs(p.y - center.y) - length, 0.0);
+    double dz = std::max(std::abs(p.z - center.z) - length, 0.0);
+    return std::sqrt(dx*dx + dy*dy + dz*dz);
+}
+
+#endif /* GRAVITY_KERNEL_H */
@@ -0,0 +1,155 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <functional>
+#include <string>
+
+#include "body_soa.h"
+#include "thread_pool.h"
+
+//fills ax/ay/az of every body for the current positions
+typedef std::function<void()> ForcePass;
+
+//v += dt * a and x += dt * v over the raw arrays, blocks are independent and
+//the inner loops have no aliasing so they vectorize
+inline void kick_bodies(BodySoA &bodies, ThreadPool &pool, double dt) {
+    const size_t block = 4096;
+    size_t n = bodies.size();
+
+    pool.parallel_for(0, (n + block - 1) / block, 1, [&](size_t k) {
+        size_t begin = k * block;
+        size_t end = std::min(begin + block, n);
+
+        double *__restrict vx = bodies.vx.data();
+        double *__restrict vy = bodies.vy.data();
+        double *__restrict vz = bodies.vz.data();
+        const double *__restrict ax = bodies.ax.data();
+        const double *__restrict ay = bodies.ay.data();
+        const double *__restrict az = bodies.az.data();
+
+        for(size_t i = begin; i < end; i++) {
+            vx[i] += dt * ax[i];
+            vy[i] += dt * ay[i];
+            vz[i] += dt * az[i];
+        }
+    });
+}
+
+inline void drift_bodies(BodySoA &bodies, ThreadPool &pool, double dt) {
+    const size_t block = 4096;
+    size_t n = bodies.size();
+
+    pool.parallel_for(0, (n + block - 1) / block, 1, [&](size_t k) {
+        size_t begin = k * block;
+        size_t end = std::min(begin + block, n);
+
+        double *__restrict x = bodies.x.data();
+        double *__restrict y = bodies.y.data();
+        double *__restrict z = bodies.z.data();
+        const double *__restrict vx = bodies.vx.data();
+        const double *__restrict vy = bodies.vy.data();
+        const double *__restrict vz = bodies.vz.data();
+
+        for(size_t i = begin; i < end; i++) {
+            x[i] += dt * vx[i];
+            y[i] += dt * vy[i];
+            z[i] += dt * vz[i];
+        }
+    });
+}
+
+//advances every body by dt, calling forces whenever it needs accelerations
+//at the current positions. integrators that carry accelerations over from
+//the last step must be reset when bodies are replaced or edited
+class Integrator {
+public:
+    virtual ~Integrator() {}
+
+    virtual void step(BodySoA &bodies, ThreadPool &pool, double dt, const ForcePass &forces) = 0;
+    virtual const char* name() const = 0;
+
+    virtual void reset() {}
+};
+
+//first order, one force pass per step. what Universe used to do
+class SymplecticEuler : public Integrator {
+public:
+    void step(BodySoA &bodies, ThreadPool &pool, double dt, const ForcePass &forces) override {
+        forces();
+        kick_bodies(bodies, pool, dt);
+        drift_bodies(bodies, pool, dt);
+    }
+
+    const char* name() const override {
+        return "euler";
+    }
+};
+
+//second order kick-drift-kick. the closing kick's accelerations open the
+//next step, so it's still one force pass per step after the first
+class LeapfrogKDK : public Integrator {
+public:
+    LeapfrogKDK() {
+        this->primed = false;
+    }
+
+    void step(BodySoA &bodies, ThreadPool &pool, double dt, const ForcePass &forces) override {
+        substep(bodies, pool, dt, forces);
+    }
+
+    const char* name() const override {
+        return "kdk";
+    }
+
+    void reset() override {
+        primed = false;
+    }
+
+protected:
+    bool primed;
+
+    void substep(BodySoA &bodies, ThreadPool &pool, double dt, const ForcePass &forces) {
+        if(!primed)
+            forces();
+        primed = true;
+
+        kick_bodies(bodies, pool, 0.5 * dt);
+        drift_bodies(bodies, pool, dt);
+        forces();
+        kick_bodies(bodies, pool, 0.5 * dt);
+    }
+};
+
+//fourth order Yoshida, three leapfrog substeps of w1, w0, w1 times dt with
+//w0 < 0. three force passes per step, pays off once the step can grow by
+//more than 3x at the same energy error
+class Yoshida4 : public LeapfrogKDK {
+public:
+    void step(BodySoA &bodies, ThreadPool &pool, double dt, const ForcePass &forces) override {
+        const double cbrt2 = std::cbrt(2.0);
+        const double w1 = 1.0 / (2.0 - cbrt2);
+        const double w0 = -cbrt2 / (2.0 - cbrt2);
+
+        substep(bodies, pool, w1 * dt, forces);
+        substep(bodies, pool, w0 * dt, forces);
+        substep(bodies, pool, w1 * dt, forces);
+    }
+
+    const char* name() const override {
+        return "yoshida4";
+    }
+};
+
+//integrator for a name() string, LeapfrogKDK for anything unknown
+inline Integrator* make_integrator(const std::string &name) {
+    if(name == "euler")
+        return new SymplecticEuler();
+    if(name == "yoshida4")
+        return new Yoshida4();
+    return new LeapfrogKDK();
+}
+
+#endif /* INTEGRATOR_H */
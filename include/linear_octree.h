@@ -0,0 +1,767 @@
+#ifndef LINEAR_OCTREE_H
+#define LINEAR_OCTREE_H
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+
+#include "glm/glm.hpp"
+#include "body3d.h"
+#include "body_soa.h"
+#include "gravity_kernel.h"
+#include "thread_pool.h"
+
+//bits per axis in a morton key, 3*21 = 63 bits total
+const int MORTON_BITS = 21;
+
+enum MultipoleOrder {
+    MONOPOLE,       //mass at the center of mass only, same as Node3D
+    QUADRUPOLE      //plus the traceless quadrupole about the center of mass
+};
+
+struct LinearNode {
+    glm::dvec3 center;      //same convention as Node3D, length is half the cube size
+    double length;
+    glm::dvec3 com;         //center of mass
+    double mass;
+    double quad[6];         //sum m (3 x_i x_j - r^2 d_ij) about com, xx yy zz xy xz yz
+    unsigned int first;     //range of bodies in morton order
+    unsigned int count;
+    unsigned int next;      //node after this subtree, next == index + 1 means leaf
+};
+
+//default bucket size of LinearOctree leaves
+const unsigned int LEAF_SIZE = 16;
+
+//pointerless octree, bodies are sorted by morton key and every node is a
+//contiguous range of that order. nodes are stored depth first so a walk is a
+//single forward loop over the array that jumps to `next` to skip a subtree.
+//leaves are buckets of up to leaf_size bodies summed directly once opened
+class LinearOctree {
+public:
+    glm::dvec3 center;
+    double length;
+    double theta;
+    MultipoleOrder expansion;
+    unsigned int group_size;    //bodies sharing one walk, 0 walks every body on its own
+    unsigned int leaf_size;     //nodes with at most this many bodies aren't split
+
+    std::vector<LinearNode> nodes;
+    std::vector<glm::dvec4> points;     //x, y, z, mass in morton order
+    std::vector<unsigned int> order;    //morton order -> index into bodies
+
+    LinearOctree() {
+        this->center = glm::dvec3(0.0f);
+        this->length = 0.0;
+        this->theta = 0.5;
+        this->expansion = MONOPOLE;
+        this->group_size = 32;
+        this->leaf_size = LEAF_SIZE;
+        this->built_size = 0;
+        this->last_escaped = 0.0;
+    }
+
+    //with a pool the keys, the sort and the subtrees are spread over its
+    //threads. the result is the same tree, bit for bit, as the serial build
+    void build(const BodySoA &bodies, glm::dvec3 center, double length, ThreadPool *pool = NULL) {
+        this->center = center;
+        this->length = length;
+
+        compute_keys(bodies, pool);
+        sort_keys(pool);
+
+        points.resize(order.size());
+        for_range(pool, 0, order.size(), 4096, [&](size_t i) {
+            unsigned int k = order[i];
+            points[i] = glm::dvec4(bodies.x[k], bodies.y[k], bodies.z[k], bodies.mass[k]);
+        });
+
+        build_nodes(pool);
+
+        //cells as built, refit measures how far bodies have strayed from them
+        built_size = bodies.size();
+        built_cells.resize(nodes.size());
+        for_range(pool, 0, nodes.size(), 4096, [&](size_t i) {
+            built_cells[i] = glm::dvec4(nodes[i].center, nodes[i].length);
+        });
+    }
+
+    //keeps the topology and body order of the last build and refits masses,
+    //moments and boxes to the current positions bottom up. every box becomes
+    //the tightest cube around its bodies so the walks stay correct. returns
+    //false without touching the tree when the body count changed or more
+    //than max_escaped of the bodies have left the leaf cell they were built
+    //in, the caller should build instead
+    bool refit(const BodySoA &bodies, double max_escaped, ThreadPool *pool = NULL) {
+        if(nodes.empty() || bodies.size() != built_size)
+            return false;
+
+        //leaves check their bodies against the built cells first
+        size_t cutoff = std::max<size_t>(leaf_size, order.size() / ((pool ? pool->size() : 1) * 16));
+        plan_refit(cutoff);
+        escaped.assign(refit_tasks.size(), 0);
+        for_range(pool, 0, refit_tasks.size(), 1, [&](size_t t) {
+            unsigned int root = refit_tasks[t];
+            for(unsigned int i = root; i < nodes[root].next; i++) {
+                const LinearNode &n = nodes[i];
+                if(n.next != i + 1)
+                    continue;
+                glm::dvec3 c(built_cells[i]);
+                double l = built_cells[i].w;
+                for(unsigned int j = n.first; j < n.first + n.count; j++) {
+                    glm::dvec3 d = glm::abs(bodies.position(order[j]) - c);
+                    if(d.x > l || d.y > l || d.z > l)
+                        escaped[t]++;
+                }
+            }
+        });
+
+        size_t total = 0;
+        for(size_t t = 0; t < escaped.size(); t++)
+            total += escaped[t];
+        last_escaped = (double)total / order.size();
+        if(last_escaped > max_escaped)
+            return false;
+
+        for_range(pool, 0, order.size(), 4096, [&](size_t i) {
+            unsigned int k = order[i];
+            points[i] = glm::dvec4(bodies.x[k], bodies.y[k], bodies.z[k], bodies.mass[k]);
+        });
+
+        //disjoint subtrees in parallel, then the nodes above them, children
+        //always come after their parent so reverse preorder is bottom up
+        box_lo.resize(nodes.size());
+        box_hi.resize(nodes.size());
+        for_range(pool, 0, refit_tasks.size(), 1, [&](size_t t) {
+            unsigned int root = refit_tasks[t];
+            for(unsigned int i = nodes[root].next; i-- > root;)
+                refit_node(i);
+        });
+        for(size_t k = refit_top.size(); k-- > 0;)
+            refit_node(refit_top[k]);
+
+        return true;
+    }
+
+    //fraction of bodies outside their built leaf cell at the last refit
+    double escaped_fraction() const {
+        return last_escaped;
+    }
+
+    //acceleration at p, self is the index of the body at p so it can skip itself.
+    //split > 0 gives the TreePM short range part only, with r_s = split
+    glm::dvec3 acceleration(const glm::dvec3 &p, unsigned int self, double split = 0.0) const {
+        static thread_local PointBatch batch;
+        static thread_local std::vector<unsigned int> cells;
+        batch.clear();
+        cells.clear();
+        collect(p, self, batch, cells, split);
+
+        glm::dvec3 a(0.0f);
+        if(split > 0.0)
+            gravity_accumulate_short(p, batch, split, a);
+        else
+            gravity_accumulate(p, batch, a);
+        for(size_t k = 0; k < cells.size(); k++) {
+            const LinearNode &n = nodes[cells[k]];
+            glm::dvec3 q = quadrupole_acceleration(p, n);
+            if(split > 0.0)
+                q *= short_range_factor(glm::length(p - n.com), split);
+            a += q;
+        }
+        return a;
+    }
+
+    //walks the tree and appends every leaf body and accepted node felt at p,
+    //accepted nodes also go to cells when their quadrupole is used. with a
+    //split, nodes further than SPLIT_CUTOFF * split from p are skipped whole
+    void collect(const glm::dvec3 &p, unsigned int self, PointBatch &batch, std::vector<unsigned int> &cells,
+                 double split = 0.0) const {
+        double cutoff = SPLIT_CUTOFF * split;
+        unsigned int i = 0;
+        while(i < nodes.size()) {
+            const LinearNode &n = nodes[i];
+
+            if(split > 0.0 && cube_distance(p, n.center, n.length) > cutoff) {
+                i = n.next;
+                continue;
+            }
+
+            glm::dvec3 delta = n.com - p;
+            double d = std::sqrt(delta.x*delta.x + delta.y*delta.y + delta.z*delta.z);
+            if((n.length/d) < theta && !inside(p, n)) {
+                batch.push(n.com, n.mass);
+                if(expansion == QUADRUPOLE && n.count > 1)
+                    cells.push_back(i);
+                i = n.next;
+            }
+            else if(n.next == i + 1) {
+                //opened bucket, its bodies are summed directly
+                for(unsigned int j = n.first; j < n.first + n.count; j++) {
+                    if(order[j] == self)
+                        continue;
+                    batch.push(glm::dvec3(points[j]), points[j].w);
+                }
+                i = n.next;
+            }
+            else {
+                i++;
+            }
+        }
+    }
+
+    //subtrees of at most group_size bodies, topmost first. each one is walked
+    //once for all of its bodies by group_acceleration
+    const std::vector<unsigned int>& groups() {
+        group_list.clear();
+        unsigned int i = 0;
+        while(i < nodes.size()) {
+            if(nodes[i].count <= group_size || nodes[i].next == i + 1) {
+                group_list.push_back(i);
+                i = nodes[i].next;
+            }
+            else {
+                i++;
+            }
+        }
+        return group_list;
+    }
+
+    //accelerations of the bodies of node g, out[k] belongs to points[first + k].
+    //the interaction lists come from one walk against the whole cube of g so
+    //they hold for every body in it, then each body sums them in one batch
+    void group_acceleration(unsigned int g, glm::dvec3 *out, double split = 0.0) const {
+        static thread_local PointBatch batch;
+        static thread_local std::vector<unsigned int> cells;
+        batch.clear();
+        cells.clear();
+        collect_group(g, batch, cells, split);
+
+        const LinearNode &group = nodes[g];
+        for(unsigned int k = 0; k < group.count; k++) {
+            glm::dvec3 p(points[group.first + k]);
+            glm::dvec3 a(0.0f);
+            //the body itself is in the batch, the kernels skip r == 0
+            if(split > 0.0)
+                gravity_accumulate_short(p, batch, split, a);
+            else
+                gravity_accumulate(p, batch, a);
+            for(size_t c = 0; c < cells.size(); c++) {
+                const LinearNode &n = nodes[cells[c]];
+                glm::dvec3 q = quadrupole_acceleration(p, n);
+                if(split > 0.0)
+                    q *= short_range_factor(glm::length(p - n.com), split);
+                a += q;
+            }
+            out[k] = a;
+        }
+    }
+
+    //collect for a whole group: a node is accepted when it passes the opening
+    //test from the nearest point of the group's cube and doesn't overlap it
+    void collect_group(unsigned int g, PointBatch &batch, std::vector<unsigned int> &cells, double split = 0.0) const {
+        const LinearNode &group = nodes[g];
+        double cutoff = SPLIT_CUTOFF * split;
+        unsigned int i = 0;
+        while(i < nodes.size()) {
+            const LinearNode &n = nodes[i];
+
+            if(split > 0.0 && cube_gap(n, group) > cutoff) {
+                i = n.next;
+                continue;
+            }
+
+            double d = cube_distance(n.com, group.center, group.length);
+            if(!overlaps(n, group) && (n.length/d) < theta) {
+                batch.push(n.com, n.mass);
+                if(expansion == QUADRUPOLE && n.count > 1)
+                    cells.push_back(i);
+                i = n.next;
+            }
+            else if(n.next == i + 1) {
+                for(unsigned int j = n.first; j < n.first + n.count; j++)
+                    batch.push(glm::dvec3(points[j]), points[j].w);
+                i = n.next;
+            }
+            else {
+                i++;
+            }
+        }
+    }
+
+    //appends the index of every body within radius of p, self included
+    void collect_within(const glm::dvec3 &p, double radius, std::vector<unsigned int> &out) const {
+        double r2 = radius * radius;
+        unsigned int i = 0;
+        while(i < nodes.size()) {
+            const LinearNode &n = nodes[i];
+            if(cube_distance(p, n.center, n.length) > radius) {
+                i = n.next;
+                continue;
+            }
+            if(n.next == i + 1) {
+                for(unsigned int j = n.first; j < n.first + n.count; j++) {
+                    glm::dvec3 d = glm::dvec3(points[j]) - p;
+                    if(d.x*d.x + d.y*d.y + d.z*d.z <= r2)
+                        out.push_back(order[j]);
+                }
+                i = n.next;
+            }
+            else {
+                i++;
+            }
+        }
+    }
+
+    //the k bodies closest to p as (squared distance, body index), nearest
+    //first. a best first walk, children are pushed so the closest one is
+    //popped next and anything further than the current k-th body is skipped
+    void nearest(const glm::dvec3 &p, unsigned int k, std::vector<std::pair<double, unsigned int>> &out) const {
+        static thread_local std::vector<unsigned int> stack;
+        out.clear();
+        if(k == 0 || nodes.empty())
+            return;
+
+        //out is a max heap on distance while the walk runs
+        stack.clear();
+        stack.push_back(0);
+        while(!stack.empty()) {
+            unsigned int i = stack.back();
+            stack.pop_back();
+            const LinearNode &n = nodes[i];
+
+            double d = cube_distance(p, n.center, n.length);
+            if(out.size() == k && d * d > out.front().first)
+                continue;
+
+            if(n.next == i + 1) {
+                for(unsigned int j = n.first; j < n.first + n.count; j++) {
+                    glm::dvec3 delta = glm::dvec3(points[j]) - p;
+                    std::pair<double, unsigned int> candidate(glm::dot(delta, delta), order[j]);
+                    if(out.size() < k) {
+                        out.push_back(candidate);
+                        std::push_heap(out.begin(), out.end());
+                    }
+                    else if(candidate < out.front()) {
+                        std::pop_heap(out.begin(), out.end());
+                        out.back() = candidate;
+                        std::push_heap(out.begin(), out.end());
+                    }
+                }
+                continue;
+            }
+
+            std::pair<double, unsigned int> children[8];
+            int count = 0;
+            for(unsigned int c = i + 1; c < n.next; c = nodes[c].next)
+                children[count++] = std::make_pair(cube_distance(p, nodes[c].center, nodes[c].length), c);
+            std::sort(children, children + count);
+            for(int c = count; c-- > 0;)
+                stack.push_back(children[c].second);
+        }
+
+        std::sort_heap(out.begin(), out.end());
+    }
+
+    //a cell is never accepted by a body inside it, its com can be far enough
+    //away for the opening angle test while the body sits right next to its mass
+    static bool inside(const glm::dvec3 &p, const LinearNode &n) {
+        return  std::abs(p.x - n.center.x) <= n.length &&
+                std::abs(p.y - n.center.y) <= n.length &&
+                std::abs(p.z - n.center.z) <= n.length;
+    }
+
+    static bool overlaps(const LinearNode &a, const LinearNode &b) {
+        double l = a.length + b.length;
+        return  std::abs(a.center.x - b.center.x) < l &&
+                std::abs(a.center.y - b.center.y) < l &&
+                std::abs(a.center.z - b.center.z) < l;
+    }
+
+    //smallest distance between the cubes of a and b, 0 when they touch
+    static double cube_gap(const LinearNode &a, const LinearNode &b) {
+        return cube_distance(a.center, b.center, a.length + b.length);
+    }
+
+    //adds mass m at offset d from the com to the traceless quadrupole q
+    static void add_quadrupole(double *q, const glm::dvec3 &d, double m) {
+        double d2 = d.x*d.x + d.y*d.y + d.z*d.z;
+        q[0] += m * (3*d.x*d.x - d2);
+        q[1] += m * (3*d.y*d.y - d2);
+        q[2] += m * (3*d.z*d.z - d2);
+        q[3] += m * 3*d.x*d.y;
+        q[4] += m * 3*d.x*d.z;
+        q[5] += m * 3*d.y*d.z;
+    }
+
+    //quadrupole term only, the monopole goes through the gravity kernel.
+    //a = G (Q r / r^5 - 5/2 (r.Q.r) r / r^7) with r pointing from com to p
+    static glm::dvec3 quadrupole_acceleration(const glm::dvec3 &p, const LinearNode &n) {
+        const double *q = n.quad;
+        glm::dvec3 r = p - n.com;
+        double r2 = r.x*r.x + r.y*r.y + r.z*r.z;
+        double inv_r2 = 1.0 / r2;
+        double inv_r5 = inv_r2 * inv_r2 / std::sqrt(r2);
+
+        glm::dvec3 qr(q[0]*r.x + q[3]*r.y + q[4]*r.z,
+                      q[3]*r.x + q[1]*r.y + q[5]*r.z,
+                      q[4]*r.x + q[5]*r.y + q[2]*r.z);
+        double rqr = r.x*qr.x + r.y*qr.y + r.z*qr.z;
+
+        return GRAVITY * inv_r5 * (qr - 2.5 * rqr * inv_r2 * r);
+    }
+
+private:
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> keys_tmp;
+    std::vector<unsigned int> order_tmp;
+    std::vector<size_t> histogram;
+
+    size_t built_size;                  //bodies.size() at the last build
+    std::vector<glm::dvec4> built_cells;    //center, length of every node as built
+    std::vector<unsigned int> refit_tasks, refit_top;
+    std::vector<size_t> escaped;
+    std::vector<glm::dvec3> box_lo, box_hi;
+    double last_escaped;
+    std::vector<unsigned int> group_list;
+
+    static uint64_t spread_bits(uint64_t v) {
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffffULL;
+        v = (v | v << 16) & 0x1f0000ff0000ffULL;
+        v = (v | v << 8)  & 0x100f00f00f00f00fULL;
+        v = (v | v << 4)  & 0x10c30c30c30c30c3ULL;
+        v = (v | v << 2)  & 0x1249249249249249ULL;
+        return v;
+    }
+
+    bool contains(const glm::dvec3 &p) {
+        return  (p.x >= center.x - length && p.x < center.x + length) &&
+                (p.y >= center.y - length && p.y < center.y + length) &&
+                (p.z >= center.z - length && p.z < center.z + length);
+    }
+
+    uint64_t morton_key(const glm::dvec3 &p) {
+        const uint64_t cells = 1ULL << MORTON_BITS;
+        double scale = cells / (2.0 * length);
+        glm::dvec3 origin = center - glm::dvec3(length);
+
+        uint64_t ix = std::min((uint64_t)((p.x - origin.x) * scale), cells - 1);
+        uint64_t iy = std::min((uint64_t)((p.y - origin.y) * scale), cells - 1);
+        uint64_t iz = std::min((uint64_t)((p.z - origin.z) * scale), cells - 1);
+
+        return (spread_bits(ix) << 2) | (spread_bits(iy) << 1) | spread_bits(iz);
+    }
+
+    //keys of bodies outside the root cube, they sort last and get cut off
+    static const uint64_t OUTSIDE_KEY = ~0ULL;
+
+    template <typename F>
+    static void for_range(ThreadPool *pool, size_t begin, size_t end, size_t grain, F fn) {
+        if(pool == NULL) {
+            for(size_t i = begin; i < end; i++)
+                fn(i);
+            return;
+        }
+        pool->parallel_for(begin, end, grain, fn);
+    }
+
+    void compute_keys(const BodySoA &bodies, ThreadPool *pool) {
+        size_t n = bodies.size();
+        keys.resize(n);
+        order.resize(n);
+        for_range(pool, 0, n, 4096, [&](size_t i) {
+            glm::dvec3 p = bodies.position(i);
+            //bodies outside the root cube are dropped, same as Node3D::insert
+            keys[i] = contains(p) ? morton_key(p) : OUTSIDE_KEY;
+            order[i] = i;
+        });
+    }
+
+    //lsd radix sort of (key, index) pairs, 8 bits per pass. every block counts
+    //its digits and scatters its own keys, blocks keep their order so the
+    //sort stays stable for any number of threads
+    void sort_keys(ThreadPool *pool) {
+        const size_t block = 1 << 14;
+        size_t n = keys.size();
+        size_t blocks = (n + block - 1) / block;
+        keys_tmp.resize(n);
+        order_tmp.resize(n);
+        histogram.resize(blocks * 256);
+
+        for(int shift = 0; shift < 64; shift += 8) {
+            for_range(pool, 0, blocks, 1, [&](size_t b) {
+                size_t *count = &histogram[b * 256];
+                std::fill(count, count + 256, 0);
+                for(size_t i = b * block; i < std::min(n, (b + 1) * block); i++)
+                    count[(keys[i] >> shift) & 0xff]++;
+            });
+
+            //every key has the same digit, nothing to move
+            if(n == 0)
+                break;
+            size_t same = 0;
+            for(size_t b = 0; b < blocks; b++)
+                same += histogram[b * 256 + ((keys[0] >> shift) & 0xff)];
+            if(same == n)
+                continue;
+
+            //digit major, block minor offsets
+            size_t offset = 0;
+            for(int d = 0; d < 256; d++) {
+                for(size_t b = 0; b < blocks; b++) {
+                    size_t c = histogram[b * 256 + d];
+                    histogram[b * 256 + d] = offset;
+                    offset += c;
+                }
+            }
+
+            for_range(pool, 0, blocks, 1, [&](size_t b) {
+                size_t *count = &histogram[b * 256];
+                for(size_t i = b * block; i < std::min(n, (b + 1) * block); i++) {
+                    size_t dst = count[(keys[i] >> shift) & 0xff]++;
+                    keys_tmp[dst] = keys[i];
+                    order_tmp[dst] = order[i];
+                }
+            });
+            keys.swap(keys_tmp);
+            order.swap(order_tmp);
+        }
+
+        size_t inside = std::lower_bound(keys.begin(), keys.end(), OUTSIDE_KEY) - keys.begin();
+        keys.resize(inside);
+        order.resize(inside);
+    }
+
+    void build_nodes(ThreadPool *pool) {
+        nodes.clear();
+        if(order.empty())
+            return;
+
+        if(pool == NULL || pool->size() == 1) {
+            build_node(nodes, 0, order.size(), 0, center, length);
+            return;
+        }
+
+        //subtrees small enough to be one task are built on their own, then
+        //the levels above them are built again serially, splicing them in
+        size_t cutoff = std::max<size_t>(leaf_size, order.size() / (pool->size() * 16));
+        tasks.clear();
+        plan_tasks(0, order.size(), 0, center, length, cutoff);
+
+        subtrees.resize(tasks.size());
+        pool->parallel_for(0, tasks.size(), 1, [&](size_t t) {
+            const BuildTask &task = tasks[t];
+            subtrees[t].clear();
+            build_node(subtrees[t], task.first, task.count, task.level, task.center, task.length);
+        });
+
+        next_task = 0;
+        build_top(0, order.size(), 0, center, length, cutoff);
+    }
+
+    //same split as the FMM sinks, subtrees of at most cutoff bodies and the
+    //nodes above them in preorder
+    void plan_refit(size_t cutoff) {
+        refit_tasks.clear();
+        refit_top.clear();
+        unsigned int i = 0;
+        while(i < nodes.size()) {
+            if(nodes[i].count <= cutoff || nodes[i].next == i + 1) {
+                refit_tasks.push_back(i);
+                i = nodes[i].next;
+            }
+            else {
+                refit_top.push_back(i);
+                i++;
+            }
+        }
+    }
+
+    void refit_node(unsigned int index) {
+        LinearNode &n = nodes[index];
+        bool leaf = (n.next == index + 1);
+        glm::dvec3 com(0.0f);
+        double mass = 0.0;
+        glm::dvec3 lo, hi;
+
+        if(leaf) {
+            lo = hi = glm::dvec3(points[n.first]);
+            for(unsigned int j = n.first; j < n.first + n.count; j++) {
+                glm::dvec3 p(points[j]);
+                com += p * points[j].w;
+                mass += points[j].w;
+                lo = glm::min(lo, p);
+                hi = glm::max(hi, p);
+            }
+        }
+        else {
+            lo = box_lo[index + 1];
+            hi = box_hi[index + 1];
+            for(unsigned int c = index + 1; c < n.next; c = nodes[c].next) {
+                com += nodes[c].com * nodes[c].mass;
+                mass += nodes[c].mass;
+                lo = glm::min(lo, box_lo[c]);
+                hi = glm::max(hi, box_hi[c]);
+            }
+        }
+
+        box_lo[index] = lo;
+        box_hi[index] = hi;
+        glm::dvec3 extent = hi - lo;
+        n.center = 0.5 * (lo + hi);
+        n.length = 0.5 * std::max(extent.x, std::max(extent.y, extent.z));
+        n.com = (n.count == 1) ? glm::dvec3(points[n.first]) : com / mass;
+        n.mass = mass;
+
+        if(expansion == QUADRUPOLE)
+            compute_quadrupole(nodes, index, leaf);
+    }
+
+    //calls fn(first, count, cc, h) for every non empty child of a node, in
+    //octant order. children are the runs of equal octant digit at level
+    template <typename F>
+    void for_each_child(unsigned int first, unsigned int count, int level, glm::dvec3 c, double l, F fn) {
+        int shift = 3 * (MORTON_BITS - 1 - level);
+        unsigned int begin = first;
+        unsigned int end = first + count;
+        for(uint64_t q = 0; q < 8 && begin < end; q++) {
+            unsigned int split = std::partition_point(keys.begin() + begin, keys.begin() + end,
+                [&](uint64_t k) { return ((k >> shift) & 7) <= q; }) - keys.begin();
+            if(split == begin)
+                continue;
+
+            double h = l / 2;
+            glm::dvec3 cc(c.x + ((q & 4) ? h : -h),
+                          c.y + ((q & 2) ? h : -h),
+                          c.z + ((q & 1) ? h : -h));
+            fn(begin, split - begin, cc, h);
+
+            begin = split;
+        }
+    }
+
+    bool is_leaf_range(unsigned int count, int level) const {
+        return count <= std::max(leaf_size, 1u) || level == MORTON_BITS;
+    }
+
+    //appends the subtree of a range to out, depth first. next indices are
+    //relative to out so subtrees built apart can be spliced later
+    void build_node(std::vector<LinearNode> &out, unsigned int first, unsigned int count, int level, glm::dvec3 c, double l) {
+        unsigned int index = out.size();
+        out.push_back(LinearNode());
+        out[index].center = c;
+        out[index].length = l;
+        out[index].first = first;
+        out[index].count = count;
+
+        glm::dvec3 com(0.0f);
+        double mass = 0.0;
+        bool leaf = is_leaf_range(count, level);
+
+        if(leaf) {
+            for(unsigned int j = first; j < first + count; j++) {
+                com += glm::dvec3(points[j]) * points[j].w;
+                mass += points[j].w;
+            }
+        }
+        else {
+            for_each_child(first, count, level, c, l, [&](unsigned int f, unsigned int n, glm::dvec3 cc, double h) {
+                unsigned int child = out.size();
+                build_node(out, f, n, level + 1, cc, h);
+                com += out[child].com * out[child].mass;
+                mass += out[child].mass;
+            });
+        }
+
+        finish_node(out, index, leaf, com, mass);
+    }
+
+    void finish_node(std::vector<LinearNode> &out, unsigned int index, bool leaf, glm::dvec3 com, double mass) {
+        LinearNode &n = out[index];
+        n.com = (n.count == 1) ? glm::dvec3(points[n.first]) : com / mass;
+        n.mass = mass;
+        n.next = out.size();
+
+        if(expansion == QUADRUPOLE)
+            compute_quadrupole(out, index, leaf);
+    }
+
+    struct BuildTask {
+        unsigned int first, count;
+        int level;
+        glm::dvec3 center;
+        double length;
+    };
+
+    std::vector<BuildTask> tasks;
+    std::vector<std::vector<LinearNode>> subtrees;
+    size_t next_task;
+
+    //the ranges that become tasks, in the order build_top meets them
+    void plan_tasks(unsigned int first, unsigned int count, int level, glm::dvec3 c, double l, size_t cutoff) {
+        if(count <= cutoff || is_leaf_range(count, level)) {
+            BuildTask task = {first, count, level, c, l};
+            tasks.push_back(task);
+            return;
+        }
+        for_each_child(first, count, level, c, l, [&](unsigned int f, unsigned int n, glm::dvec3 cc, double h) {
+            plan_tasks(f, n, level + 1, cc, h, cutoff);
+        });
+    }
+
+    //build_node for the levels above the tasks, copying every finished
+    //subtree into place with its next indices shifted
+    void build_top(unsigned int first, unsigned int count, int level, glm::dvec3 c, double l, size_t cutoff) {
+        if(count <= cutoff || is_leaf_range(count, level)) {
+            const std::vector<LinearNode> &sub = subtrees[next_task++];
+            unsigned int offset = nodes.size();
+            nodes.insert(nodes.end(), sub.begin(), sub.end());
+            for(size_t i = offset; i < nodes.size(); i++)
+                nodes[i].next += offset;
+            return;
+        }
+
+        unsigned int index = nodes.size();
+        nodes.push_back(LinearNode());
+        nodes[index].center = c;
+        nodes[index].length = l;
+        nodes[index].first = first;
+        nodes[index].count = count;
+
+        glm::dvec3 com(0.0f);
+        double mass = 0.0;
+        for_each_child(first, count, level, c, l, [&](unsigned int f, unsigned int n, glm::dvec3 cc, double h) {
+            unsigned int child = nodes.size();
+            build_top(f, n, level + 1, cc, h, cutoff);
+            com += nodes[child].com * nodes[child].mass;
+            mass += nodes[child].mass;
+        });
+
+        finish_node(nodes, index, false, com, mass);
+    }
+
+    //leaves sum their bodies, internal nodes shift each child's quadrupole
+    //to their own com (parallel axis) so the pass stays bottom up
+    void compute_quadrupole(std::vector<LinearNode> &out, unsigned int index, bool leaf) {
+        LinearNode &n = out[index];
+        std::fill(n.quad, n.quad + 6, 0.0);
+
+        if(leaf) {
+            for(unsigned int j = n.first; j < n.first + n.count; j++)
+                add_quadrupole(n.quad, glm::dvec3(points[j]) - n.com, points[j].w);
+            return;
+        }
+
+        for(unsigned int c = index + 1; c < n.next; c = out[c].next) {
+            const LinearNode &child = out[c];
+            for(int k = 0; k < 6; k++)
+                n.quad[k] += child.quad[k];
+            add_quadrupole(n.quad, child.com - n.com, child.mass);
+        }
+    }
+};
+
+#endif /* LINEAR_OCTREE_H */
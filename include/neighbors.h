@@ -0,0 +1,97 @@
+#ifndef NEIGHBORS_H
+#define NEIGHBORS_H
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <algorithm>
+
+#include "glm/glm.hpp"
+#include "linear_octree.h"
+#include "thread_pool.h"
+
+//answers of a batch of queries packed back to back. the bodies found for
+//query q are indices[offsets[q]] up to indices[offsets[q + 1]], as indices
+//into the body array the tree was built from
+struct NeighborList {
+    std::vector<size_t> offsets;
+    std::vector<unsigned int> indices;
+
+    size_t size() const {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+
+    size_t count(size_t q) const {
+        return offsets[q + 1] - offsets[q];
+    }
+
+    const unsigned int* begin(size_t q) const {
+        return indices.data() + offsets[q];
+    }
+
+    const unsigned int* end(size_t q) const {
+        return indices.data() + offsets[q + 1];
+    }
+};
+
+//runs fn(q, found) for every query on the pool. blocks of queries fill their
+//own buffers which are then packed in query order, so the list is the same
+//for any thread count
+template <typename F>
+void batch_query(size_t queries, ThreadPool &pool, NeighborList &out, F fn) {
+    const size_t block = 256;
+    size_t blocks = (queries + block - 1) / block;
+
+    std::vector<std::vector<unsigned int>> found(blocks);
+    std::vector<std::vector<size_t>> counts(blocks);
+
+    pool.parallel_for(0, blocks, 1, [&](size_t b) {
+        found[b].clear();
+        counts[b].clear();
+        for(size_t q = b * block; q < std::min(queries, (b + 1) * block); q++) {
+            size_t before = found[b].size();
+            fn(q, found[b]);
+            counts[b].push_back(found[b].size() - before);
+        }
+    });
+
+    out.offsets.resize(queries + 1);
+    out.offsets[0] = 0;
+    std::vector<size_t> starts(blocks);
+    size_t q = 0;
+    for(size_t b = 0; b < blocks; b++) {
+        starts[b] = out.offsets[q];
+        for(size_t c : counts[b]) {
+            out.offsets[q + 1] = out.offsets[q] + c;
+            q++;
+        }
+    }
+
+    out.indices.resize(out.offsets[queries]);
+    pool.parallel_for(0, blocks, 1, [&](size_t b) {
+        std::copy(found[b].begin(), found[b].end(), out.indices.begin() + starts[b]);
+    });
+}
+
+//every body within radius of each point, in tree order. a body sitting on
+//the query point is part of its own answer
+inline void radius_query(const LinearOctree &tree, const std::vector<glm::dvec3> &points, double radius,
+                         ThreadPool &pool, NeighborList &out) {
+    batch_query(points.size(), pool, out, [&](size_t q, std::vector<unsigned int> &found) {
+        tree.collect_within(points[q], radius, found);
+    });
+}
+
+//the k closest bodies to each point, nearest first. fewer when the tree
+//holds fewer than k bodies
+inline void nearest_query(const LinearOctree &tree, const std::vector<glm::dvec3> &points, unsigned int k,
+                          ThreadPool &pool, NeighborList &out) {
+    batch_query(points.size(), pool, out, [&](size_t q, std::vector<unsigned int> &found) {
+        static thread_local std::vector<std::pair<double, unsigned int>> best;
+        tree.nearest(points[q], k, best);
+        for(const std::pair<double, unsigned int> &b : best)
+            found.push_back(b.second);
+    });
+}
+
+#endif /* NEIGHBORS_H */
@@ -6,6 +6,8 @@
 
 #include "glm/glm.hpp"
 #include "body3d.h"
+#include "arena.h"
+#include "gravity_kernel.h"
 
 enum Quadrant {
             //x     y       z
@@ -20,37 +22,66 @@ enum Quadrant {
     NONE
 };
 
+class Node3D;
+
+//backing storage for one tree build, owned by Universe and reset every step
+struct TreeArena {
+    Pool<Node3D> nodes;
+    Pool<Body3D> bodies;    //aggregate (center of mass) bodies of internal nodes
+
+    void reset() {
+        nodes.reset();
+        bodies.reset();
+    }
+
+    std::size_t bytes_used() const {
+        return nodes.bytes_used() + bodies.bytes_used();
+    }
+
+    std::size_t peak_bytes() const {
+        return nodes.bytes_peak() + bodies.bytes_peak();
+    }
+
+    double bytes_per_node() const {
+        if(nodes.size() == 0)
+            return 0.0;
+        return (double)bytes_used() / nodes.size();
+    }
+};
+
 class Node3D {
 public:
     glm::dvec3 center;
     double length;
     Body3D *body;
+    TreeArena *arena;
 
     Node3D *quads[8] = {};
 
     Node3D() {}
-    Node3D(glm::dvec3 center, double length) {
+    Node3D(glm::dvec3 center, double length, TreeArena *arena) {
         this->center = center;
         this->length = length;
         this->body = NULL;
+        this->arena = arena;
     }
 
     void subdivide() {
         double l = length/2;
-        quads[RTF] = new Node3D(glm::dvec3(center.x + l, center.y + l, center.z + l), l);
-        quads[LTF] = new Node3D(glm::dvec3(center.x - l, center.y + l, center.z + l), l);
-        quads[RBF] = new Node3D(glm::dvec3(center.x + l, center.y - l, center.z + l), l);
-        quads[LBF] = new Node3D(glm::dvec3(center.x - l, center.y - l, center.z + l), l);
-        quads[RTB] = new Node3D(glm::dvec3(center.x + l, center.y + l, center.z - l), l);
-        quads[LTB] = new Node3D(glm::dvec3(center.x - l, center.y + l, center.z - l), l);
-        quads[RBB] = new Node3D(glm::dvec3(center.x + l, center.y - l, center.z - l), l);
-        quads[LBB] = new Node3D(glm::dvec3(center.x - l, center.y - l, center.z - l), l);
+        quads[RTF] = arena->nodes.create(glm::dvec3(center.x + l, center.y + l, center.z + l), l, arena);
+        quads[LTF] = arena->nodes.create(glm::dvec3(center.x - l, center.y + l, center.z + l), l, arena);
+        quads[RBF] = arena->nodes.create(glm::dvec3(center.x + l, center.y - l, center.z + l), l, arena);
+        quads[LBF] = arena->nodes.create(glm::dvec3(center.x - l, center.y - l, center.z + l), l, arena);
+        quads[RTB] = arena->nodes.create(glm::dvec3(center.x + l, center.y + l, center.z - l), l, arena);
+        quads[LTB] = arena->nodes.create(glm::dvec3(center.x - l, center.y + l, center.z - l), l, arena);
+        quads[RBB] = arena->nodes.create(glm::dvec3(center.x + l, center.y - l, center.z - l), l, arena);
+        quads[LBB] = arena->nodes.create(glm::dvec3(center.x - l, center.y - l, center.z - l), l, arena);
     }
 
     bool contains(Body3D &b) {
-        return  (b.position.x > center.x - length && b.position.x < center.x + length) &&
-                (b.position.y > center.y - length && b.position.y < center.y + length) &&
-                (b.position.z > center.z - length && b.position.z < center.z + length);
+        return  (b.position.x >= center.x - length && b.position.x < center.x + length) &&
+                (b.position.y >= center.y - length && b.position.y < center.y + length) &&
+                (b.position.z >= center.z - length && b.position.z < center.z + length);
     }
 
     Quadrant get_quadrant(glm::dvec3 p) {
@@ -76,21 +107,21 @@ public:
 
     Node3D* create_node(Quadrant q) {
         if(q == RTF)
-            return new Node3D(glm::dvec3(center.x + length/2, center.y + length/2, center.z + length/2), length/2);
+            return arena->nodes.create(glm::dvec3(center.x + length/2, center.y + length/2, center.z + length/2), length/2, arena);
         if(q == LTF)
-            return new Node3D(glm::dvec3(center.x - length/2, center.y + length/2, center.z + length/2), length/2);
+            return arena->nodes.create(glm::dvec3(center.x - length/2, center.y + length/2, center.z + length/2), length/2, arena);
         if(q == RBF)
-            return new Node3D(glm::dvec3(center.x + length/2, center.y - length/2, center.z + length/2), length/2);
+            return arena->nodes.create(glm::dvec3(center.x + length/2, center.y - length/2, center.z + length/2), length/2, arena);
         if(q == LBF)
-            return new Node3D(glm::dvec3(center.x - length/2, center.y - length/2, center.z + length/2), length/2);
+            return arena->nodes.create(glm::dvec3(center.x - length/2, center.y - length/2, center.z + length/2), length/2, arena);
         if(q == RTB)
-            return new Node3D(glm::dvec3(center.x + length/2, center.y + length/2, center.z - length/2), length/2);
+            return arena->nodes.create(glm::dvec3(center.x + length/2, center.y + length/2, center.z - length/2), length/2, arena);
         if(q == LTB)
-            return new Node3D(glm::dvec3(center.x - length/2, center.y + length/2, center.z - length/2), length/2);
+            return arena->nodes.create(glm::dvec3(center.x - length/2, center.y + length/2, center.z - length/2), length/2, arena);
         if(q == RBB)
-            return new Node3D(glm::dvec3(center.x + length/2, center.y - length/2, center.z - length/2), length/2);
+            return arena->nodes.create(glm::dvec3(center.x + length/2, center.y - length/2, center.z - length/2), length/2, arena);
         if(q == LBB)
-            return new Node3D(glm::dvec3(center.x - length/2, center.y - length/2, center.z - length/2), length/2);
+            return arena->nodes.create(glm::dvec3(center.x - length/2, center.y - length/2, center.z - length/2), length/2, arena);
 
         return NULL;
     }
@@ -115,42 +146,62 @@ public:
             return;
         }
 
-        //get current node body quadrant
-        Quadrant body_q = get_quadrant(body->position);
-        //get new body quadrant
-        Quadrant new_q = get_quadrant(b.position);
+        bool leaf = isExternal();
 
-        if(quads[body_q] == NULL) {
-            //create new node for current node body
+        if(leaf) {
+            //push current node body down, only real bodies live in leaves
+            Quadrant body_q = get_quadrant(body->position);
             quads[body_q] = create_node(body_q);
             quads[body_q]->insert(*body);
         }
-        //quads[body_q]->insert(*body);
-        
+
+        //get new body quadrant
+        Quadrant new_q = get_quadrant(b.position);
+
         if(quads[new_q] == NULL) {
             //create new node for new body
             quads[new_q] = create_node(new_q);
         }
         quads[new_q]->insert(b);
 
-        body = Body3D::add(*body, b);
+        //internal nodes own their aggregate, update it in place after the first split
+        if(leaf)
+            body = arena->bodies.create(Body3D::add(*body, b));
+        else
+            *body = Body3D::add(*body, b);
+    }
+
+    //split > 0 only adds the TreePM short range force, with r_s = split
+    void update_force(Body3D &b, double split = 0.0) {
+        static thread_local PointBatch batch;
+        batch.clear();
+        collect(b, batch, split);
+
+        glm::dvec3 a(0.0f);
+        if(split > 0.0)
+            gravity_accumulate_short(b.position, batch, split, a);
+        else
+            gravity_accumulate(b.position, batch, a);
+        b.force += b.mass * a;
     }
 
-    void update_force(Body3D &b) {
-        if(body == NULL || b == *body)
+    //gathers the bodies and aggregates b interacts with, evaluated in one
+    //batch by update_force. with a split the walk stops at nodes further
+    //than SPLIT_CUTOFF * split from b
+    void collect(Body3D &b, PointBatch &batch, double split = 0.0) {
+        //leaves point at the bodies themselves, identity skips b without
+        //reading fields other walkers are writing
+        if(body == NULL || body == &b)
             return;
 
-        if(isExternal()) {
-            // b.add_force(*body);
+        if(split > 0.0 && cube_distance(b.position, center, length) > SPLIT_CUTOFF * split)
+            return;
 
-            if(body->collision(b)) {
-                Body3D *tmp = Body3D::add(*body, b);
-                b = *tmp;
-                body = NULL;
-            }
-            else {
-                b.add_force(*body);
-            }
+        if(isExternal()) {
+            //the walk only writes to b so many bodies can share the tree,
+            //coincident bodies would divide by zero and are skipped
+            if(!body->collision(b))
+                batch.push(body->position, body->mass);
         }
         else {
             double s = length;
@@ -160,12 +211,12 @@ public:
             // }
             double d = body->distance_to(b);
             if((s/d) < THETA) {
-                b.add_force(*body);
+                batch.push(body->position, body->mass);
             }
             else{
                 for(int i = 0; i < 8; i++) {
                     if(quads[i] != NULL)
-                        quads[i]->update_force(b);
+                        quads[i]->collect(b, batch, split);
                 }
             }
 
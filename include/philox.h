@@ -0,0 +1,41 @@
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <cstdint>
+
+//Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+//a keyed bijection of a 128 bit counter, so the numbers for any counter can
+//be made on any thread in any order and come out the same
+struct Philox4x32 {
+    uint32_t v[4];
+
+    Philox4x32(uint64_t seed, uint64_t index, uint32_t stream = 0, uint32_t block = 0) {
+        uint32_t ctr[4] = {(uint32_t)index, (uint32_t)(index >> 32), stream, block};
+        uint32_t key[2] = {(uint32_t)seed, (uint32_t)(seed >> 32)};
+
+        for(int round = 0; round < 10; round++) {
+            uint64_t p0 = (uint64_t)0xD2511F53 * ctr[0];
+            uint64_t p1 = (uint64_t)0xCD9E8D57 * ctr[2];
+            uint32_t next[4] = {
+                (uint32_t)(p1 >> 32) ^ ctr[1] ^ key[0],
+                (uint32_t)p1,
+                (uint32_t)(p0 >> 32) ^ ctr[3] ^ key[1],
+                (uint32_t)p0
+            };
+            for(int k = 0; k < 4; k++)
+                ctr[k] = next[k];
+            key[0] += 0x9E3779B9;
+            key[1] += 0xBB67AE85;
+        }
+
+        for(int k = 0; k < 4; k++)
+            v[k] = ctr[k];
+    }
+
+    //word k as a double in [0, 1)
+    double uniform(int k) const {
+        return v[k] * (1.0 / 4294967296.0);
+    }
+};
+
+#endif /* PHILOX_H */
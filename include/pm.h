@@ -0,0 +1,287 @@
+#ifndef PM_H
+#define PM_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "glm/glm.hpp"
+#include "body3d.h"
+#include "body_soa.h"
+#include "fft.h"
+#include "gravity_kernel.h"
+#include "thread_pool.h"
+
+enum MassAssignment {
+    CIC,    //cloud in cell, 2 cells per axis
+    TSC     //triangular shaped cloud, 3 cells per axis
+};
+
+//particle mesh gravity: bodies are deposited on a grid, the potential comes
+//from one FFT convolution with the Green's function and the accelerations are
+//4 point differences of it, interpolated back with the deposit kernel.
+//isolated boundaries zero pad the grid to twice its size, periodic ones don't
+class PmSolver {
+public:
+    MassAssignment assignment;
+    bool periodic;
+    double split;               //r_s of the long range filter (TreePM), 0 means full gravity
+
+    std::vector<glm::dvec3> acc;    //acceleration per body, same order as bodies
+
+    PmSolver() {
+        this->cells = 64;
+        this->assignment = TSC;
+        this->periodic = false;
+        this->split = 0.0;
+        this->green_h = 0.0;
+        this->green_split = -1.0;
+        this->green_periodic = false;
+        this->green_n = 0;
+    }
+
+    //cells per side covering the root cube
+    unsigned int grid() const {
+        return cells;
+    }
+
+    //the FFT is radix-2 only, anything but a power of two >= 2 is refused
+    //and leaves the grid as it was
+    bool set_grid(unsigned int cells) {
+        if(!valid_grid(cells))
+            return false;
+        this->cells = cells;
+        return true;
+    }
+
+    static bool valid_grid(unsigned int cells) {
+        return cells >= 2 && is_power_of_two(cells);
+    }
+
+    //cell size evaluate will use for a root cube of half size length. isolated
+    //grids snap it up to a 1/16 octave so the cached Green's function survives
+    //a root that moves a little every step
+    double cell_size(double length) const {
+        double h = 2.0 * length / cells;
+        if(periodic)
+            return h;
+        return std::exp2(std::ceil(std::log2(h) * 16.0) / 16.0);
+    }
+
+    void evaluate(const BodySoA &bodies, ThreadPool &pool, glm::dvec3 center, double length) {
+        n = cells;
+        m = periodic ? n : 2 * n;
+        h = cell_size(length);
+        origin = center - glm::dvec3(0.5 * h * n);
+
+        setup_green(pool);
+        deposit(bodies);
+
+        mesh.forward(pool);
+        pool.parallel_for(0, mesh.data.size(), 1 << 15, [&](size_t i) {
+            mesh.data[i] *= green.data[i].real();
+        });
+        mesh.inverse(pool);
+
+        differentiate(pool);
+        interpolate(bodies, pool);
+    }
+
+private:
+    unsigned int cells;
+    size_t n, m;                //grid cells per side, mesh cells per side (padded)
+    double h;
+    glm::dvec3 origin;
+
+    Fft3D mesh;                 //mass, then its transform, then the potential
+    Fft3D green;                //transformed Green's function, cached
+    double green_h, green_split;
+    bool green_periodic;
+    size_t green_n;
+
+    std::vector<double> gx, gy, gz; //acceleration on the n^3 grid
+    double total_mass;
+    glm::dvec3 total_com;
+
+    size_t wrap(long i) const {
+        long mm = m;
+        return ((i % mm) + mm) % mm;
+    }
+
+    //first cell and weights along one axis, u is in cell units from the grid origin
+    int stencil(double u, long &start, double *w) const {
+        u -= 0.5;
+        if(assignment == CIC) {
+            double f = std::floor(u);
+            double d = u - f;
+            start = (long)f;
+            w[0] = 1.0 - d;
+            w[1] = d;
+            return 2;
+        }
+        double c = std::floor(u + 0.5);
+        double d = u - c;
+        start = (long)c - 1;
+        w[0] = 0.5 * (0.5 - d) * (0.5 - d);
+        w[1] = 0.75 - d * d;
+        w[2] = 0.5 * (0.5 + d) * (0.5 + d);
+        return 3;
+    }
+
+    //isolated grids drop cells outside the n^3 block, periodic ones wrap
+    bool in_grid(long i) const {
+        return periodic || (i >= 0 && i < (long)n);
+    }
+
+    void setup_green(ThreadPool &pool) {
+        if(green_n == m && green_h == h && green_split == split && green_periodic == periodic)
+            return;
+        green_n = m;
+        green_h = h;
+        green_split = split;
+        green_periodic = periodic;
+
+        green.resize(m);
+        mesh.resize(m);
+
+        if(periodic) {
+            //-4 pi G / k^2 on cell masses, with the gaussian long range filter
+            double box = m * h;
+            pool.parallel_for(0, m * m * m, 4096, [&](size_t i) {
+                long k[3] = {(long)(i % m), (long)((i / m) % m), (long)(i / (m * m))};
+                double k2 = 0.0;
+                for(int a = 0; a < 3; a++) {
+                    double kk = 2.0 * M_PI / box * (k[a] <= (long)m / 2 ? k[a] : k[a] - (long)m);
+                    k2 += kk * kk;
+                }
+                double g = (k2 == 0.0) ? 0.0 : -4.0 * M_PI * GRAVITY / (k2 * h * h * h);
+                green.data[i] = Complex(g * std::exp(-k2 * split * split), 0.0);
+            });
+            return;
+        }
+
+        //-G erf(r / 2 r_s) / r in real space on the padded mesh, wrapped
+        //distances so the convolution is the isolated one on the n^3 block
+        pool.parallel_for(0, m * m * m, 4096, [&](size_t i) {
+            long k[3] = {(long)(i % m), (long)((i / m) % m), (long)(i / (m * m))};
+            double r2 = 0.0;
+            for(int a = 0; a < 3; a++) {
+                double d = std::min(k[a], (long)m - k[a]);
+                r2 += d * d;
+            }
+            //the cell's own potential exerts no force, keep it finite
+            double r = (r2 == 0.0) ? 0.5 * h : std::sqrt(r2) * h;
+            double g = -GRAVITY / r;
+            if(split > 0.0)
+                g *= std::erf(r / (2.0 * split));
+            green.data[i] = Complex(g, 0.0);
+        });
+        green.forward(pool);
+    }
+
+    void deposit(const BodySoA &bodies) {
+        std::fill(mesh.data.begin(), mesh.data.end(), Complex(0.0, 0.0));
+        total_mass = 0.0;
+        total_com = glm::dvec3(0.0f);
+
+        for(size_t b = 0; b < bodies.size(); b++) {
+            glm::dvec3 u = (bodies.position(b) - origin) / h;
+            long s[3];
+            double w[3][3];
+            int c = stencil(u.x, s[0], w[0]);
+            stencil(u.y, s[1], w[1]);
+            stencil(u.z, s[2], w[2]);
+
+            double mass = bodies.mass[b];
+            total_mass += mass;
+            total_com += mass * bodies.position(b);
+
+            for(int k = 0; k < c; k++) {
+                if(!in_grid(s[2] + k))
+                    continue;
+                for(int j = 0; j < c; j++) {
+                    if(!in_grid(s[1] + j))
+                        continue;
+                    for(int i = 0; i < c; i++) {
+                        if(!in_grid(s[0] + i))
+                            continue;
+                        mesh.at(wrap(s[0] + i), wrap(s[1] + j), wrap(s[2] + k)) += mass * w[0][i] * w[1][j] * w[2][k];
+                    }
+                }
+            }
+        }
+
+        if(total_mass > 0.0)
+            total_com /= total_mass;
+    }
+
+    double potential(long x, long y, long z) {
+        return mesh.at(wrap(x), wrap(y), wrap(z)).real();
+    }
+
+    //d phi along one axis at cell c from the potential at c +- 1 and c +- 2.
+    //the padded mesh wraps distances at m - n = n, so it holds the isolated
+    //potential one cell past the block but not two: there the far side of the
+    //block looks n - 1 cells away instead of n + 1. isolated edge cells use
+    //the 2 point difference, which only reaches the cells that are right
+    double slope(long c, double p1, double m1, double p2, double m2) const {
+        if(!periodic && (c == 0 || c == (long)n - 1))
+            return 0.5 * (p1 - m1) / h;
+        return ((2.0/3.0) * (p1 - m1) - (1.0/12.0) * (p2 - m2)) / h;
+    }
+
+    //a = -grad phi, 4 point central differences
+    void differentiate(ThreadPool &pool) {
+        gx.resize(n * n * n);
+        gy.resize(n * n * n);
+        gz.resize(n * n * n);
+
+        pool.parallel_for(0, n * n * n, 4096, [&](size_t i) {
+            long x = i % n, y = (i / n) % n, z = i / (n * n);
+            gx[i] = -slope(x, potential(x+1, y, z), potential(x-1, y, z), potential(x+2, y, z), potential(x-2, y, z));
+            gy[i] = -slope(y, potential(x, y+1, z), potential(x, y-1, z), potential(x, y+2, z), potential(x, y-2, z));
+            gz[i] = -slope(z, potential(x, y, z+1), potential(x, y, z-1), potential(x, y, z+2), potential(x, y, z-2));
+        });
+    }
+
+    void interpolate(const BodySoA &bodies, ThreadPool &pool) {
+        acc.resize(bodies.size());
+
+        pool.parallel_for(0, bodies.size(), 256, [&](size_t b) {
+            glm::dvec3 u = (bodies.position(b) - origin) / h;
+            long s[3];
+            double w[3][3];
+            int c = stencil(u.x, s[0], w[0]);
+            stencil(u.y, s[1], w[1]);
+            stencil(u.z, s[2], w[2]);
+
+            //bodies reaching past an isolated grid only see the total mass,
+            //filtered the same way as the grid when there's a split
+            if(!periodic && (s[0] < 0 || s[1] < 0 || s[2] < 0 ||
+                             s[0] + c > (long)n || s[1] + c > (long)n || s[2] + c > (long)n)) {
+                glm::dvec3 p = bodies.position(b);
+                acc[b] = Body3D::acceleration(p, total_com, total_mass);
+                if(split > 0.0)
+                    acc[b] *= 1.0 - short_range_factor(glm::length(p - total_com), split);
+                return;
+            }
+
+            glm::dvec3 a(0.0f);
+            for(int k = 0; k < c; k++) {
+                size_t z = (s[2] + k + n) % n;
+                for(int j = 0; j < c; j++) {
+                    size_t y = (s[1] + j + n) % n;
+                    for(int i = 0; i < c; i++) {
+                        size_t x = (s[0] + i + n) % n;
+                        size_t idx = (z * n + y) * n + x;
+                        double wt = w[0][i] * w[1][j] * w[2][k];
+                        a += wt * glm::dvec3(gx[idx], gy[idx], gz[idx]);
+                    }
+                }
+            }
+            acc[b] = a;
+        });
+    }
+};
+
+#endif /* PM_H */
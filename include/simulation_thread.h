@@ -0,0 +1,73 @@
+#ifndef SIMULATION_THREAD_H
+#define SIMULATION_THREAD_H
+
+#include <thread>
+#include <atomic>
+#include <vector>
+
+#include "universe.h"
+#include "triple_buffer.h"
+
+//steps a Universe with a fixed dt on its own thread as fast as it can and
+//publishes a PointVertex snapshot after every step. the render loop only
+//ever touches the snapshots, never the bodies
+class SimulationThread {
+public:
+    Universe &universe;
+    double dt;
+    TripleBuffer<std::vector<PointVertex>> snapshots;
+
+    SimulationThread(Universe &universe, double dt) : universe(universe) {
+        this->dt = dt;
+        this->running = false;
+        this->steps = 0;
+    }
+
+    ~SimulationThread() {
+        stop();
+    }
+
+    void start() {
+        if(running)
+            return;
+
+        //something to draw before the first step finishes
+        universe.snapshot(snapshots.back());
+        snapshots.publish();
+
+        running = true;
+        thread = std::thread(&SimulationThread::run, this);
+    }
+
+    void stop() {
+        running = false;
+        if(thread.joinable())
+            thread.join();
+    }
+
+    //newest published snapshot, call from the render thread only
+    const std::vector<PointVertex>& latest() {
+        snapshots.update();
+        return snapshots.front();
+    }
+
+    unsigned long long step_count() const {
+        return steps;
+    }
+
+private:
+    std::thread thread;
+    std::atomic<bool> running;
+    std::atomic<unsigned long long> steps;
+
+    void run() {
+        while(running) {
+            universe.simulate(dt);
+            universe.snapshot(snapshots.back());
+            snapshots.publish();
+            steps++;
+        }
+    }
+};
+
+#endif /* SIMULATION_THREAD_H */
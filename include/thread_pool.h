@@ -0,0 +1,179 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <algorithm>
+#include <cstddef>
+
+//fixed set of workers for data parallel loops. parallel_for deals chunks of
+//the range round robin onto per-worker queues, a worker drains its own queue
+//from the front and steals from the back of the others once it runs dry.
+//the calling thread takes part as worker 0
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int num_threads = 0) {
+        start(num_threads);
+    }
+
+    ~ThreadPool() {
+        stop();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
+
+    //0 picks one thread per hardware core
+    void resize(unsigned int num_threads) {
+        stop();
+        start(num_threads);
+    }
+
+    unsigned int size() const {
+        return queues.size();
+    }
+
+    //calls fn(i) for every i in [begin, end), grain indices per task
+    template <typename F>
+    void parallel_for(std::size_t begin, std::size_t end, std::size_t grain, F fn) {
+        if(begin >= end)
+            return;
+        if(grain == 0)
+            grain = 1;
+
+        if(size() == 1 || end - begin <= grain) {
+            for(std::size_t i = begin; i < end; i++)
+                fn(i);
+            return;
+        }
+
+        job = [&fn](std::size_t b, std::size_t e) {
+            for(std::size_t i = b; i < e; i++)
+                fn(i);
+        };
+
+        //set before the first push, a worker still awake from the last loop may grab it
+        pending = (end - begin + grain - 1) / grain;
+
+        std::size_t tasks = 0;
+        for(std::size_t b = begin; b < end; b += grain, tasks++) {
+            Queue &q = *queues[tasks % size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.emplace_back(b, std::min(b + grain, end));
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            generation++;
+        }
+        wake.notify_all();
+
+        work(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+    }
+
+private:
+    typedef std::pair<std::size_t, std::size_t> Task;
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::function<void(std::size_t, std::size_t)> job;
+    std::atomic<std::size_t> pending;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::size_t generation;
+    bool quit;
+
+    void start(unsigned int num_threads) {
+        if(num_threads == 0)
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+        pending = 0;
+        generation = 0;
+        quit = false;
+
+        for(unsigned int i = 0; i < num_threads; i++)
+            queues.emplace_back(new Queue());
+        for(unsigned int i = 1; i < num_threads; i++)
+            workers.emplace_back(&ThreadPool::worker, this, i);
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+
+        for(size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+        workers.clear();
+        queues.clear();
+    }
+
+    void worker(unsigned int id) {
+        std::size_t seen = 0;
+        while(true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return quit || generation != seen; });
+                if(quit)
+                    return;
+                seen = generation;
+            }
+            work(id);
+        }
+    }
+
+    bool pop(unsigned int id, Task &t) {
+        {
+            Queue &q = *queues[id];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if(!q.tasks.empty()) {
+                t = q.tasks.front();
+                q.tasks.pop_front();
+                return true;
+            }
+        }
+        for(unsigned int k = 1; k < size(); k++) {
+            Queue &q = *queues[(id + k) % size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if(!q.tasks.empty()) {
+                t = q.tasks.back();
+                q.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //no tasks are added while a loop runs, so empty queues everywhere means
+    //the rest is already in flight on other threads
+    void work(unsigned int id) {
+        Task t;
+        while(pop(id, t)) {
+            job(t.first, t.second);
+            if(--pending == 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
+    }
+};
+
+#endif /* THREAD_POOL_H */
@@ -0,0 +1,257 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#include "body_soa.h"
+#include "thread_pool.h"
+
+//file layout: a TrajectoryHeader, then one chunk per frame made of a
+//TrajectoryFrame header and the x, y, z arrays of count doubles each, so a
+//reader can hop from frame to frame by size without touching the positions
+const uint32_t TRAJECTORY_VERSION = 1;
+const char TRAJECTORY_MAGIC[8] = {'N', 'B', 'O', 'D', 'Y', 'T', 'R', 'J'};
+
+struct TrajectoryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t frame_size;        //sizeof(TrajectoryFrame) of the writer
+};
+
+struct TrajectoryFrame {
+    uint64_t step;
+    double time;
+    uint64_t count;             //bodies in this frame, merges change it between frames
+};
+
+//what the step loop paid for streaming, read after close()
+struct TrajectoryStats {
+    size_t frames;              //frames handed to the writer
+    size_t written;             //frames on disk
+    size_t dropped;             //frames skipped because the queue was full and block is off
+    size_t stalls;              //pushes that had to wait for a free buffer
+    double stall_seconds;       //time the step loop spent in those waits
+    size_t max_queued;          //deepest the queue got
+    uint64_t bytes;
+};
+
+//streams positions to disk on a thread of its own. push() copies x, y, z
+//into one of depth pooled buffers and queues it, the writer thread drains
+//the queue in order and hands the buffers back. when every buffer is queued
+//the disk is behind: push() waits for one (block) or drops the frame, and
+//either way it shows up in stats
+class TrajectoryWriter {
+public:
+    unsigned int depth;         //buffers in the pool, the most frames in flight
+    bool block;                 //wait for a buffer when the queue is full instead of dropping
+    std::string error;          //why writing stopped, empty while it's fine
+
+    TrajectoryWriter() {
+        this->depth = 4;
+        this->block = true;
+        this->file = NULL;
+        this->closing = false;
+        this->failed = false;
+        this->stats = TrajectoryStats();
+    }
+
+    ~TrajectoryWriter() {
+        close();
+    }
+
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator = (const TrajectoryWriter&) = delete;
+
+    bool open(const std::string &path) {
+        close();
+
+        file = fopen(path.c_str(), "wb");
+        if(!file) {
+            error = "can't open trajectory: " + path;
+            return false;
+        }
+
+        TrajectoryHeader h;
+        std::memset(&h, 0, sizeof(h));
+        std::memcpy(h.magic, TRAJECTORY_MAGIC, sizeof(h.magic));
+        h.version = TRAJECTORY_VERSION;
+        h.frame_size = sizeof(TrajectoryFrame);
+        if(fwrite(&h, sizeof(h), 1, file) != 1) {
+            fclose(file);
+            file = NULL;
+            error = "can't write trajectory: " + path;
+            return false;
+        }
+
+        error.clear();
+        this->path = path;
+        stats = TrajectoryStats();
+        stats.bytes = sizeof(h);
+        closing = false;
+        failed = false;
+
+        buffers.resize(std::max(depth, 1u));
+        free_frames.clear();
+        queued.clear();
+        for(size_t i = 0; i < buffers.size(); i++)
+            free_frames.push_back(i);
+
+        thread = std::thread(&TrajectoryWriter::run, this);
+        return true;
+    }
+
+    bool is_open() const {
+        return file != NULL;
+    }
+
+    //queues the current positions as one frame, false if it was dropped or
+    //the writer has failed. the copy is spread over the simulation's pool
+    bool push(const BodySoA &bodies, ThreadPool &pool, uint64_t step, double time) {
+        if(!file)
+            return false;
+
+        size_t slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stats.frames++;
+            if(failed)
+                return false;
+            if(free_frames.empty()) {
+                if(!block) {
+                    stats.dropped++;
+                    return false;
+                }
+                stats.stalls++;
+                auto start = std::chrono::steady_clock::now();
+                returned.wait(lock, [&]() { return !free_frames.empty() || failed; });
+                stats.stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if(failed)
+                    return false;
+            }
+            slot = free_frames.front();
+            free_frames.pop_front();
+        }
+
+        //the slot belongs to this thread until it's queued
+        Buffer &b = buffers[slot];
+        size_t n = bodies.size();
+        b.frame.step = step;
+        b.frame.time = time;
+        b.frame.count = n;
+        b.x.resize(n);
+        b.y.resize(n);
+        b.z.resize(n);
+
+        const size_t chunk = 1 << 16;
+        pool.parallel_for(0, (n + chunk - 1) / chunk, 1, [&](size_t k) {
+            size_t begin = k * chunk;
+            size_t count = std::min(begin + chunk, n) - begin;
+            std::memcpy(b.x.data() + begin, bodies.x.data() + begin, count * sizeof(double));
+            std::memcpy(b.y.data() + begin, bodies.y.data() + begin, count * sizeof(double));
+            std::memcpy(b.z.data() + begin, bodies.z.data() + begin, count * sizeof(double));
+        });
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queued.push_back(slot);
+            stats.max_queued = std::max(stats.max_queued, queued.size());
+        }
+        ready.notify_one();
+        return true;
+    }
+
+    //drains the queue, stops the thread and closes the file. false if any
+    //frame failed to reach the disk
+    bool close() {
+        if(!file)
+            return error.empty();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        ready.notify_one();
+        thread.join();
+
+        if(fclose(file) != 0 && !failed) {
+            failed = true;
+            error = "can't write trajectory: " + path;
+        }
+        file = NULL;
+        return !failed;
+    }
+
+    TrajectoryStats statistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+private:
+    struct Buffer {
+        TrajectoryFrame frame;
+        BodySoA::Array x, y, z;
+    };
+
+    FILE *file;
+    std::string path;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable ready;      //a frame was queued or close() was called
+    std::condition_variable returned;   //a buffer went back to the pool
+    std::vector<Buffer> buffers;
+    std::deque<size_t> free_frames;
+    std::deque<size_t> queued;
+    bool closing;
+    bool failed;
+    TrajectoryStats stats;
+
+    void run() {
+        while(true) {
+            size_t slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&]() { return !queued.empty() || closing; });
+                if(queued.empty())
+                    return;
+                slot = queued.front();
+                queued.pop_front();
+            }
+
+            //the file is only touched here while the thread runs
+            Buffer &b = buffers[slot];
+            size_t bytes = b.frame.count * sizeof(double);
+            bool good = failed ||
+                        (fwrite(&b.frame, sizeof(b.frame), 1, file) == 1 &&
+                         (bytes == 0 || (fwrite(b.x.data(), bytes, 1, file) == 1 &&
+                                         fwrite(b.y.data(), bytes, 1, file) == 1 &&
+                                         fwrite(b.z.data(), bytes, 1, file) == 1)));
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(!good) {
+                    failed = true;
+                    error = "can't write trajectory: " + path;
+                }
+                else if(!failed) {
+                    stats.written++;
+                    stats.bytes += sizeof(b.frame) + 3 * bytes;
+                }
+                free_frames.push_back(slot);
+            }
+            returned.notify_one();
+        }
+    }
+};
+
+#endif /* TRAJECTORY_H */
@@ -0,0 +1,53 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+//lock free single producer / single consumer hand off. the writer fills
+//back() and publish()es it, the reader calls update() and reads front().
+//neither side ever waits, the reader just sees the newest published slot
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : middle(1) {
+        back_index = 0;
+        front_index = 2;
+    }
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator = (const TripleBuffer&) = delete;
+
+    //writer side
+    T& back() {
+        return slots[back_index];
+    }
+
+    void publish() {
+        int old = middle.exchange(back_index | FRESH, std::memory_order_acq_rel);
+        back_index = old & INDEX;
+    }
+
+    //reader side, returns true when front() changed
+    bool update() {
+        if(!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        int old = middle.exchange(front_index, std::memory_order_acq_rel);
+        front_index = old & INDEX;
+        return true;
+    }
+
+    const T& front() const {
+        return slots[front_index];
+    }
+
+private:
+    static const int INDEX = 3;
+    static const int FRESH = 4;     //middle slot holds data the reader hasn't taken
+
+    T slots[3];
+    std::atomic<int> middle;
+    int back_index;
+    int front_index;
+};
+
+#endif /* TRIPLE_BUFFER_H */
@@ -1,85 +1,217 @@
 #ifndef UNIVERSE_H
 #define UNIVERSE_H
 
+//HEADLESS builds Universe without any GL code, for render-less batch runs
+#ifndef HEADLESS
 #include "glad/glad.h"
 #include "GLFW/glfw3.h"
+#endif
 
 #include "glm/glm.hpp"
 #include "../include/glm/gtc/matrix_transform.hpp"
 
 #include "body3d.h"
+#include "body_soa.h"
 #include "node3d.h"
+#include "linear_octree.h"
+#include "fmm.h"
+#include "pm.h"
+#include "integrator.h"
+#include "direct.h"
+#include "neighbors.h"
+#include "philox.h"
+#include "thread_pool.h"
+#ifndef HEADLESS
 #include "shader.h"
+#endif
 
 #include <vector>
 #include <cmath>
 #include <ctime>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+enum TreeBuilder {
+    POINTER_TREE,   //recursive Node3D::insert, kept for A/B comparison
+    LINEAR_TREE     //morton sorted LinearOctree
+};
+
+enum ForceSolver {
+    BARNES_HUT,     //per body tree walk on the tree picked by TreeBuilder
+    FAST_MULTIPOLE, //FmmSolver on the linear tree
+    PARTICLE_MESH,  //PmSolver on a grid over the root cube, no tree
+    TREE_PM         //PmSolver long range plus a short range walk on the TreeBuilder tree
+};
+
+//per body vertex attributes, mass is normalized to the generated star range
+struct PointVertex {
+    glm::vec3 position;
+    float mass;
+    glm::vec3 velocity;
+};
 
 class Universe {
 private:
+#ifndef HEADLESS
     unsigned int VAO, VBO;
+    std::vector<PointVertex> vertices;
+#endif
+    std::vector<glm::dvec3> block_min, block_max;
+    std::vector<size_t> block_outside;
+    std::vector<unsigned int> active;
+    std::vector<std::vector<unsigned int>> rung_bodies;    //bodies on each rung, kept by block_step
+    bool between_syncs;     //block_step is inside dt, trees are refit rather than rebuilt
+    NeighborList candidates;
+    std::vector<glm::dvec3> positions;
+    std::vector<unsigned int> parent;
     
 public:
     int num_bodies;
     double size;
+    uint64_t seed;          //generate() is a pure function of it
+    ForceSolver solver;
+    TreeBuilder builder;
     Node3D bh_tree;
-    std::vector<Body3D> bodies;
+    TreeArena arena;
+    LinearOctree linear_tree;
+    FmmSolver fmm;
+    PmSolver pm;
+    DirectSolver direct;    //exact reference for force_error
+    double split_scale;     //TreePM r_s in PM cells, the grid size is pm.grid()
+    bool dynamic_bounds;    //fit the root cube to the bodies every step, otherwise it's fixed at size
+    glm::dvec3 root_center; //root cube of the last force pass, length is half its side
+    double root_length;
+    size_t outside_bodies;  //bodies outside the root cube in the last force pass, the trees leave them out
+    bool refit_tree;        //refit the linear tree between builds instead of building every step
+    double refit_threshold; //rebuild once more than this fraction of bodies left their leaf cell
+    size_t tree_builds, tree_refits;
+    bool block_timesteps;   //power of two step per body, only bodies ending a step get new forces
+    unsigned int max_rung;  //smallest block step is the base step / 2^max_rung
+    double eta;             //a body wants a step of eta |a| / |da/dt|
+    std::vector<unsigned char> rungs;   //block step of each body is the base step / 2^rung
+    std::vector<glm::dvec3> step_acc;   //acceleration of each body at the start of its block step
+    std::unique_ptr<Integrator> integrator; //steps without block timesteps, LeapfrogKDK by default
+    size_t force_evaluations;           //bodies that got a new force, summed over every pass
+    bool merge_collisions;  //merge bodies closer than collision_radius after every step
+    double collision_radius;
+    size_t merged_bodies;   //bodies absorbed by merges so far
+    uint64_t step_count;    //simulate() calls so far
+    double sim_time;        //simulated seconds so far
+    ThreadPool pool;
+    BodySoA bodies;
+    std::vector<Body3D> bodies_aos;     //Body3D copy of bodies for the pointer tree
 
     Universe(int num_bodies, double size) {
         this->num_bodies = num_bodies;
         this->size = size * 9.4e15;
+        this->seed = (uint64_t)time(0);
+        this->solver = BARNES_HUT;
+        this->builder = LINEAR_TREE;
+        this->split_scale = 1.25;
+        this->dynamic_bounds = true;
+        this->root_center = glm::dvec3(0.0f);
+        this->root_length = this->size;
+        this->outside_bodies = 0;
+        this->refit_tree = false;
+        this->refit_threshold = 0.05;
+        this->tree_builds = 0;
+        this->tree_refits = 0;
+        this->block_timesteps = false;
+        this->between_syncs = false;
+        this->max_rung = 10;
+        this->eta = 0.05;
+        this->force_evaluations = 0;
+        this->merge_collisions = false;
+        this->collision_radius = SOFTENING;
+        this->merged_bodies = 0;
+        this->step_count = 0;
+        this->sim_time = 0.0;
+        this->integrator.reset(new LeapfrogKDK());
         //this->bh_tree = Node3D(glm::dvec3(0.0f), size);
     }
 
-    void setup() {
-        float vertex[] = {0.5f, 0.5f, 0.5f};
+    //0 uses every hardware thread, results don't depend on the count
+    void set_threads(unsigned int num_threads) {
+        pool.resize(num_threads);
+    }
 
+#ifndef HEADLESS
+    void setup() {
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
 
         glBindVertexArray(VAO);
-
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertex), vertex, GL_STATIC_DRAW);
 
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(float), (void*)(3*sizeof(float)));
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(PointVertex), (void*)offsetof(PointVertex, position));
         glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(PointVertex), (void*)offsetof(PointVertex, mass));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(PointVertex), (void*)offsetof(PointVertex, velocity));
+        glEnableVertexAttribArray(2);
+
+        glBindVertexArray(0);
+
+        //point size comes from the vertex shader
+        glEnable(GL_PROGRAM_POINT_SIZE);
     }
 
+#endif
+
+    //one vertex per body in scene units, what draw() uploads
+    void snapshot(std::vector<PointVertex> &out) {
+        out.resize(bodies.size());
+        pool.parallel_for(0, bodies.size(), 4096, [&](size_t i) {
+            PointVertex &v = out[i];
+            v.position = (glm::vec3)(bodies.position(i) / 9.4e15);
+            v.mass = (bodies.mass[i] - 0.08*2e30) / (150*2e30 - 0.08*2e30);
+            glm::dvec3 vel = bodies.velocity(i);
+            v.velocity = (vel == glm::dvec3(0.0f)) ? glm::vec3(0.0f) : (glm::vec3)glm::normalize(vel);
+        });
+    }
+
+#ifndef HEADLESS
     void draw(Shader shader) {
-        glBindVertexArray(VAO);
-        glPointSize(2);
-        for(int i = 0; i < bodies.size(); i++) {
-            glm::mat4 model = glm::mat4(1.0f);
-            glm::dvec3 pos = bodies[i].position / 9.4e15;
-            model = glm::translate(model, (glm::vec3)pos);
-            shader.setMat4("model", model);
-
-            double mass_n = (bodies[i].mass - 0.08*2e30) / (150*2e30 - 0.08*2e30);
-            if(mass_n > 1.0f) {
-                glPointSize(4);
-            }
-            else
-                glPointSize(2);
+        snapshot(vertices);
+        draw(shader, vertices);
+    }
 
-            shader.setFloat("mass", mass_n);
+    //streams the points into VBO and draws them with a single call, doesn't
+    //read bodies so it's safe while another thread is simulating
+    void draw(Shader shader, const std::vector<PointVertex> &points) {
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
 
-            shader.setVec3("velocity", glm::normalize(bodies[i].velocity));
+        //orphan the old storage so the driver doesn't stall on last frame's draw
+        size_t bytes = points.size() * sizeof(PointVertex);
+        glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, points.data());
 
-            glDrawArrays(GL_POINTS, 0, 1);
-        }
+        glDrawArrays(GL_POINTS, 0, points.size());
 
         glBindVertexArray(0);
     }
+#endif
 
+    //body i only depends on (seed, i), so bodies are made in parallel and
+    //the same seed gives the same galaxy for any thread count
     void generate(glm::dvec3 dimensions) {
         double lightyear = 9.4e15;
         double M0 = 2e30;
 
-        srand((unsigned)time(0));
+        size_t base = bodies.size();
+        bodies.resize(base + num_bodies);
+
+        pool.parallel_for(0, num_bodies, 1024, [&](size_t i) {
+            //6 uniforms per body, the point in the ellipsoid takes the first 5
+            Philox4x32 r0(seed, i, 0, 0);
+            Philox4x32 r1(seed, i, 0, 1);
+            double random[6] = {r0.uniform(0), r0.uniform(1), r0.uniform(2), r0.uniform(3), r1.uniform(0), r1.uniform(1)};
 
-        for(int i = 0; i < num_bodies; i++) {
-            glm::dvec3 position = random_point_elipsoid(dimensions * lightyear);
+            glm::dvec3 position = random_point_elipsoid(dimensions * lightyear, random);
             glm::dvec3 velocity;
 
             //orbital velocity
@@ -87,9 +219,10 @@ public:
             velocity *= sqrt((6.67e-11 * 1e6*M0) / glm::length(position));
 
             //random velocity
-            // double vx = -1.0f + static_cast <float> (rand()) /( static_cast <float> (RAND_MAX/(1.0f-(-1.0f))));
-            // double vy = -1.0f + static_cast <float> (rand()) /( static_cast <float> (RAND_MAX/(1.0f-(-1.0f))));
-            // double vz = -1.0f + static_cast <float> (rand()) /( static_cast <float> (RAND_MAX/(1.0f-(-1.0f))));
+            // Philox4x32 rv(seed, i, 1);
+            // double vx = -1.0 + 2.0 * rv.uniform(0);
+            // double vy = -1.0 + 2.0 * rv.uniform(1);
+            // double vz = -1.0 + 2.0 * rv.uniform(2);
             // velocity = glm::dvec3(
             //     vx, vy, vz
             // ) * sqrt((6.67e-11 * 1e6*M0) / (glm::length(position)));
@@ -100,23 +233,25 @@ public:
             //random mass
             double m_min = 0.08f * M0;
             double m_max = 150 * M0;
-            double mass = m_min + static_cast <float> (rand()) / ( static_cast <float> (RAND_MAX/(m_max - m_min)));
+            double mass = m_min + random[5] * (m_max - m_min);
 
-            bodies.emplace_back(Body3D(position, velocity, glm::dvec3(0.0f), mass));
-        }
+            bodies.set(base + i, Body3D(position, velocity, glm::dvec3(0.0f), mass));
+        });
 
         //black holes
         // for(int i = 0; i < 5; i++) {
         //     glm::dvec3 position = random_point_elipsoid(dimensions * lightyear);
 
-        //     bodies.emplace_back(Body3D(position, glm::dvec3(0.0f), glm::dvec3(0.0f), 1e6*M0));
+        //     bodies.push_back(Body3D(position, glm::dvec3(0.0f), glm::dvec3(0.0f), 1e6*M0));
         // }
 
-        bodies.emplace_back(Body3D(glm::dvec3(0.0f), glm::dvec3(0.0f), glm::dvec3(0.0f), 1e6*M0));
+        bodies.push_back(Body3D(glm::dvec3(0.0f), glm::dvec3(0.0f), glm::dvec3(0.0f), 1e6*M0));
+        bodies_changed();
     }
-    glm::dvec3 random_point_elipsoid(glm::dvec3 dimensions) {
-        double u = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-        double v = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+    //random holds 5 uniforms in [0, 1)
+    glm::dvec3 random_point_elipsoid(glm::dvec3 dimensions, const double *random) {
+        double u = random[0];
+        double v = random[1];
 
         double theta = u * 2.0f * 3.14f;
         double phi = acos(2.0f * v - 1.0f);
@@ -127,9 +262,9 @@ public:
         double sinPhi = sin(phi);
         double cosPhi = cos(phi);
 
-        double sx = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-        double sy = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-        double sz = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+        double sx = random[2];
+        double sy = random[3];
+        double sz = random[4];
 
         return glm::dvec3(
             sx * dimensions.x * sinPhi * cosTheta,
@@ -139,17 +274,488 @@ public:
     }
 
     void simulate(double dt) {
-        bh_tree = Node3D(glm::dvec3(0.0f), size);
+        if(block_timesteps)
+            block_step(dt*9.4e13);
+        else
+            integrator->step(bodies, pool, dt*9.4e13, [&]() { compute_forces(); });
+
+        if(merge_collisions)
+            merge_pass();
 
-        for(int i = 0; i < bodies.size(); i++) {
-            bh_tree.insert(bodies[i]);
+        step_count++;
+        sim_time += dt*9.4e13;
+    }
+
+    //true when the last force pass left a linear tree of every body behind
+    bool uses_linear_tree() const {
+        if(solver == FAST_MULTIPOLE)
+            return true;
+        return builder == LINEAR_TREE && (solver == BARNES_HUT || solver == TREE_PM);
+    }
+
+    //linear tree over the current bodies for neighbour queries. the tree of
+    //the last force pass is reused when there is one, with a first order
+    //integrator its points lag the bodies by one drift
+    const LinearOctree& query_tree() {
+        if(!uses_linear_tree() || linear_tree.order.size() + outside_bodies != bodies.size()) {
+            compute_bounds();
+            linear_tree.build(bodies, root_center, root_length, &pool);
+            tree_builds++;
         }
+        return linear_tree;
+    }
+
+    //every body within radius of each point, see NeighborList for the layout
+    void neighbors_within(const std::vector<glm::dvec3> &points, double radius, NeighborList &out) {
+        radius_query(query_tree(), points, radius, pool, out);
+    }
 
-        for(int i = 0; i < bodies.size(); i++) {
-            bodies[i].reset_force();
-            bh_tree.update_force(bodies[i]);
-            bodies[i].update(dt*9.4e13);
+    //the k nearest bodies to each point, nearest first
+    void nearest_neighbors(const std::vector<glm::dvec3> &points, unsigned int k, NeighborList &out) {
+        nearest_query(query_tree(), points, k, pool, out);
+    }
+
+    //collisions are found after the step, never during the force walk. blocks
+    //of bodies query the tree into their own candidate lists, pairs are then
+    //merged serially in index order (the lowest index of a cluster survives,
+    //mass, momentum and center of mass are conserved) and the dead bodies
+    //are compacted out so they stop costing force work. the result doesn't
+    //depend on the thread count
+    void merge_pass() {
+        size_t n = bodies.size();
+        const LinearOctree &tree = query_tree();
+
+        positions.resize(n);
+        pool.parallel_for(0, n, 4096, [&](size_t i) {
+            positions[i] = bodies.position(i);
+        });
+        radius_query(tree, positions, collision_radius, pool, candidates);
+
+        //union find over the pairs, roots are always the lowest index
+        parent.resize(n);
+        for(size_t i = 0; i < n; i++)
+            parent[i] = i;
+        size_t pairs = 0;
+        for(size_t i = 0; i < n; i++) {
+            for(const unsigned int *j = candidates.begin(i); j != candidates.end(i); j++) {
+                //the tree may lag the bodies, confirm with current positions
+                if(*j <= i || glm::length(bodies.position(*j) - positions[i]) > collision_radius)
+                    continue;
+                unsigned int a = find_root(i);
+                unsigned int b = find_root(*j);
+                if(a != b)
+                    parent[std::max(a, b)] = std::min(a, b);
+                pairs++;
+            }
         }
+        if(pairs == 0)
+            return;
+
+        //roots come first in index order, so every absorbed body folds into a
+        //root that still holds its own values plus lower absorbed ones
+        std::vector<bool> alive(n, true);
+        for(size_t i = 0; i < n; i++) {
+            unsigned int r = find_root(i);
+            if(r == i)
+                continue;
+            double m = bodies.mass[r] + bodies.mass[i];
+            double wr = bodies.mass[r] / m;
+            double wi = bodies.mass[i] / m;
+            bodies.x[r] = wr * bodies.x[r] + wi * bodies.x[i];
+            bodies.y[r] = wr * bodies.y[r] + wi * bodies.y[i];
+            bodies.z[r] = wr * bodies.z[r] + wi * bodies.z[i];
+            bodies.vx[r] = wr * bodies.vx[r] + wi * bodies.vx[i];
+            bodies.vy[r] = wr * bodies.vy[r] + wi * bodies.vy[i];
+            bodies.vz[r] = wr * bodies.vz[r] + wi * bodies.vz[i];
+            bodies.ax[r] = wr * bodies.ax[r] + wi * bodies.ax[i];
+            bodies.ay[r] = wr * bodies.ay[r] + wi * bodies.ay[i];
+            bodies.az[r] = wr * bodies.az[r] + wi * bodies.az[i];
+            bodies.mass[r] = m;
+            alive[i] = false;
+            merged_bodies++;
+        }
+
+        bodies.compact(alive);
+        bodies_changed();
+    }
+
+    unsigned int find_root(unsigned int i) {
+        while(parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    //takes ownership, the new integrator starts from fresh forces
+    void set_integrator(Integrator *integrator) {
+        this->integrator.reset(integrator);
+        this->integrator->reset();
+    }
+
+    //call after editing bodies outside of simulate(), drops the accelerations
+    //and rungs carried over between steps
+    void bodies_changed() {
+        integrator->reset();
+        rungs.clear();
+        rung_bodies.clear();
+    }
+
+    //fresh forces from the configured solver against the exact sum over
+    //samples bodies spread over the index range, 0 samples every body
+    ForceError force_error(size_t samples) {
+        compute_forces();
+        direct.pick_sample(bodies.size(), samples);
+        direct.evaluate(bodies, pool);
+        return direct.compare(bodies);
+    }
+
+    //rung body i wants inside a base step dt, from the step h it just
+    //finished: eta |a| / |da/dt|, with the jerk taken from the accelerations
+    //at both ends of that step. acceleration differences don't change when
+    //every body gets the same extra velocity, so a bulk drift moves no one
+    //between rungs, and a body at rest still gets the step its changing pull
+    //asks for. the acceleration criterion sqrt(2 eta SOFTENING / |a|) would
+    //do the same, but the softening is so short that it puts every body on
+    //max_rung. without history (h == 0) or jerk the body takes the base step
+    unsigned int pick_rung(size_t i, double dt, double h) const {
+        if(h == 0.0)
+            return 0;
+        glm::dvec3 a = bodies.acceleration(i);
+        double jerk = glm::length(a - step_acc[i]) / h;
+        if(jerk == 0.0)
+            return 0;
+        double step = eta * glm::length(a) / jerk;
+
+        unsigned int rung = 0;
+        while(rung < max_rung && dt / ((size_t)1 << rung) > step)
+            rung++;
+        return rung;
+    }
+
+    //hierarchical kick-drift-kick. every body kicks on its own power of two
+    //fraction of dt while all of them drift together, the clock jumps to the
+    //next tick where some step ends and only those bodies get new forces.
+    //a body may move to a shorter step at the end of any of its steps and
+    //to a longer one only where that step would start on the grid. the tree
+    //is refit between ticks and only rebuilt at the end of dt
+    void block_step(double dt) {
+        size_t n = bodies.size();
+        if(rungs.size() != n || rung_bodies.size() != max_rung + 1) {
+            compute_forces();
+            rungs.assign(n, 0);
+            step_acc.resize(n);
+            pool.parallel_for(0, n, 4096, [&](size_t i) {
+                step_acc[i] = bodies.acceleration(i);
+            });
+            rung_bodies.assign(max_rung + 1, std::vector<unsigned int>());
+            for(size_t i = 0; i < n; i++)
+                rung_bodies[0].push_back(i);
+        }
+
+        const size_t ticks = (size_t)1 << max_rung;
+        const double tick = dt / ticks;
+
+        //every step starts together at the beginning of dt
+        pool.parallel_for(0, n, 4096, [&](size_t i) {
+            kick(i, 0.5 * dt / ((size_t)1 << rungs[i]));
+        });
+
+        size_t t = 0;
+        while(t < ticks) {
+            size_t next = t + ((size_t)1 << (max_rung - top_rung()));
+            drift((next - t) * tick);
+            t = next;
+
+            //steps of rung low and up end at t
+            unsigned int low = 0;
+            while(t % ((size_t)1 << (max_rung - low)) != 0)
+                low++;
+            active.clear();
+            for(unsigned int r = low; r <= max_rung; r++)
+                active.insert(active.end(), rung_bodies[r].begin(), rung_bodies[r].end());
+
+            between_syncs = t < ticks;
+            compute_active_forces(active);
+            between_syncs = false;
+
+            pool.parallel_for(0, active.size(), 1024, [&](size_t k) {
+                unsigned int i = active[k];
+                double h = dt / ((size_t)1 << rungs[i]);
+                kick(i, 0.5 * h);
+
+                unsigned int rung = pick_rung(i, dt, h);
+                step_acc[i] = bodies.acceleration(i);
+                if(t == ticks) {
+                    //synchronized, the next base step can start on any rung
+                    rungs[i] = rung;
+                    return;
+                }
+                while(rung < rungs[i] && t % ((size_t)1 << (max_rung - rung)) != 0)
+                    rung++;
+                rungs[i] = rung;
+                kick(i, 0.5 * dt / ((size_t)1 << rung));
+            });
+
+            //only the active bodies changed rung and none of them below low
+            for(unsigned int r = low; r <= max_rung; r++)
+                rung_bodies[r].clear();
+            for(size_t k = 0; k < active.size(); k++)
+                rung_bodies[rungs[active[k]]].push_back(active[k]);
+        }
+    }
+
+    //shortest step any body is on
+    unsigned int top_rung() const {
+        unsigned int r = max_rung;
+        while(r > 0 && rung_bodies[r].empty())
+            r--;
+        return r;
+    }
+
+    void kick(size_t i, double dt) {
+        bodies.vx[i] += dt * bodies.ax[i];
+        bodies.vy[i] += dt * bodies.ay[i];
+        bodies.vz[i] += dt * bodies.az[i];
+    }
+
+    void drift(double dt) {
+        drift_bodies(bodies, pool, dt);
+    }
+
+    //new accelerations for the listed bodies. the others may be overwritten
+    //as well, block_step only reads a body's acceleration right after its own
+    //force pass. only the linear Barnes-Hut walk skips inactive bodies, the
+    //other solvers and big active sets take the full pass
+    void compute_active_forces(const std::vector<unsigned int> &active) {
+        if(solver != BARNES_HUT || builder != LINEAR_TREE || active.size() * 4 > bodies.size()) {
+            compute_forces();
+            return;
+        }
+
+        compute_bounds();
+        update_linear_tree();
+        pool.parallel_for(0, active.size(), 64, [&](size_t k) {
+            unsigned int i = active[k];
+            glm::dvec3 a = linear_tree.acceleration(bodies.position(i), i);
+            bodies.ax[i] = a.x;
+            bodies.ay[i] = a.y;
+            bodies.az[i] = a.z;
+        });
+        force_evaluations += active.size();
+    }
+
+    void compute_forces() {
+        force_evaluations += bodies.size();
+        compute_bounds();
+        if(solver == FAST_MULTIPOLE)
+            fmm_forces();
+        else if(solver == PARTICLE_MESH)
+            pm_forces();
+        else if(solver == TREE_PM)
+            tree_pm_forces();
+        else if(builder == LINEAR_TREE)
+            linear_tree_forces();
+        else
+            pointer_tree_forces();
+    }
+
+    //parallel min/max over the positions, each block reduces on its own and
+    //the blocks are combined in order so the result doesn't depend on threads.
+    //the same pass counts the bodies outside the root: a fixed root is known up
+    //front, and a fitted one holds every finite position by construction, so
+    //there only NaN and infinite positions are outside
+    void compute_bounds() {
+        const size_t block = 4096;
+        size_t n = bodies.size();
+        size_t blocks = (n + block - 1) / block;
+
+        //a periodic PM box is the domain itself and never moves
+        bool periodic = pm.periodic && (solver == PARTICLE_MESH || solver == TREE_PM);
+        bool fit = dynamic_bounds && !periodic;
+        root_center = glm::dvec3(0.0f);
+        root_length = size;
+
+        block_min.resize(blocks);
+        block_max.resize(blocks);
+        block_outside.resize(blocks);
+        pool.parallel_for(0, blocks, 1, [&](size_t k) {
+            size_t begin = k * block;
+            size_t end = std::min(begin + block, n);
+            glm::dvec3 lo(INFINITY);
+            glm::dvec3 hi(-INFINITY);
+            size_t outside = 0;
+            for(size_t i = begin; i < end; i++) {
+                glm::dvec3 p = bodies.position(i);
+                if(fit) {
+                    if(!(std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z))) {
+                        outside++;
+                        continue;
+                    }
+                    lo = glm::min(lo, p);
+                    hi = glm::max(hi, p);
+                }
+                else {
+                    glm::dvec3 d = glm::abs(p - root_center);
+                    //written so NaN positions count as outside too
+                    if(!(d.x < root_length && d.y < root_length && d.z < root_length))
+                        outside++;
+                }
+            }
+            block_min[k] = lo;
+            block_max[k] = hi;
+            block_outside[k] = outside;
+        });
+
+        glm::dvec3 lo(INFINITY);
+        glm::dvec3 hi(-INFINITY);
+        size_t outside = 0;
+        for(size_t k = 0; k < blocks; k++) {
+            lo = glm::min(lo, block_min[k]);
+            hi = glm::max(hi, block_max[k]);
+            outside += block_outside[k];
+        }
+        outside_bodies = outside;
+
+        //no finite body left to fit, keep the fixed root
+        if(!fit || !(lo.x <= hi.x))
+            return;
+
+        //cube around the box, padded so the largest coordinate still falls
+        //inside the half open root after the center rounds to the coordinates
+        glm::dvec3 extent = hi - lo;
+        glm::dvec3 reach = glm::max(glm::abs(lo), glm::abs(hi));
+        double half = 0.5 * std::max(extent.x, std::max(extent.y, extent.z));
+        double scale = std::max(reach.x, std::max(reach.y, reach.z));
+        root_center = 0.5 * (lo + hi);
+        root_length = std::max(half * (1.0 + 1e-9) + scale * 1e-15, SOFTENING);
+    }
+
+    void update_linear_tree() {
+        if((refit_tree || between_syncs) && linear_tree.refit(bodies, refit_threshold, &pool)) {
+            tree_refits++;
+            return;
+        }
+        linear_tree.build(bodies, root_center, root_length, &pool);
+        tree_builds++;
+    }
+
+    //split > 0 leaves only the short range force of a TreePM split
+    void linear_tree_forces(double split = 0.0) {
+        update_linear_tree();
+
+        if(linear_tree.group_size == 0) {
+            //every body sums its own force against a read only tree, so the
+            //order bodies are picked up in by the workers doesn't matter
+            pool.parallel_for(0, bodies.size(), 64, [&](size_t i) {
+                glm::dvec3 a = linear_tree.acceleration(bodies.position(i), i, split);
+                bodies.ax[i] = a.x;
+                bodies.ay[i] = a.y;
+                bodies.az[i] = a.z;
+            });
+            return;
+        }
+
+        //one walk per group of neighbouring bodies, groups are disjoint
+        const std::vector<unsigned int> &groups = linear_tree.groups();
+        const std::vector<unsigned int> &order = linear_tree.order;
+        pool.parallel_for(0, groups.size(), 4, [&](size_t k) {
+            static thread_local std::vector<glm::dvec3> acc;
+            const LinearNode &g = linear_tree.nodes[groups[k]];
+            acc.resize(g.count);
+            linear_tree.group_acceleration(groups[k], acc.data(), split);
+            for(unsigned int j = 0; j < g.count; j++) {
+                unsigned int i = order[g.first + j];
+                bodies.ax[i] = acc[j].x;
+                bodies.ay[i] = acc[j].y;
+                bodies.az[i] = acc[j].z;
+            }
+        });
+        outside_forces(split);
+    }
+
+    void pointer_tree_forces(double split = 0.0) {
+        bodies.to_aos(bodies_aos);
+
+        arena.reset();
+        bh_tree = Node3D(root_center, root_length, &arena);
+
+        for(size_t i = 0; i < bodies_aos.size(); i++) {
+            bh_tree.insert(bodies_aos[i]);
+        }
+
+        pool.parallel_for(0, bodies_aos.size(), 64, [&](size_t i) {
+            Body3D &b = bodies_aos[i];
+            b.reset_force();
+            bh_tree.update_force(b, split);
+            bodies.ax[i] = b.force.x / b.mass;
+            bodies.ay[i] = b.force.y / b.mass;
+            bodies.az[i] = b.force.z / b.mass;
+        });
+    }
+
+    void fmm_forces() {
+        update_linear_tree();
+        fmm.evaluate(linear_tree, pool);
+
+        const std::vector<unsigned int> &order = linear_tree.order;
+        pool.parallel_for(0, order.size(), 1024, [&](size_t j) {
+            unsigned int i = order[j];
+            bodies.ax[i] = fmm.acc[j].x;
+            bodies.ay[i] = fmm.acc[j].y;
+            bodies.az[i] = fmm.acc[j].z;
+        });
+
+        outside_forces();
+    }
+
+    //bodies outside the root cube aren't in the linear tree, they still feel
+    //it through a walk of their own
+    void outside_forces(double split = 0.0) {
+        const std::vector<unsigned int> &order = linear_tree.order;
+        if(order.size() == bodies.size())
+            return;
+
+        std::vector<bool> in_tree(bodies.size(), false);
+        for(size_t j = 0; j < order.size(); j++)
+            in_tree[order[j]] = true;
+        for(size_t i = 0; i < bodies.size(); i++) {
+            if(in_tree[i])
+                continue;
+            glm::dvec3 a = linear_tree.acceleration(bodies.position(i), i, split);
+            bodies.ax[i] = a.x;
+            bodies.ay[i] = a.y;
+            bodies.az[i] = a.z;
+        }
+    }
+
+    void pm_forces() {
+        pm.split = 0.0;
+        pm.evaluate(bodies, pool, root_center, root_length);
+
+        pool.parallel_for(0, bodies.size(), 1024, [&](size_t i) {
+            bodies.ax[i] = pm.acc[i].x;
+            bodies.ay[i] = pm.acc[i].y;
+            bodies.az[i] = pm.acc[i].z;
+        });
+    }
+
+    //long range from the grid, short range from a tree walk that stops at
+    //SPLIT_CUTOFF * r_s, the two halves add up to plain newtonian gravity
+    void tree_pm_forces() {
+        pm.split = split_scale * pm.cell_size(root_length);
+        pm.evaluate(bodies, pool, root_center, root_length);
+
+        if(builder == LINEAR_TREE)
+            linear_tree_forces(pm.split);
+        else
+            pointer_tree_forces(pm.split);
+
+        pool.parallel_for(0, bodies.size(), 1024, [&](size_t i) {
+            bodies.ax[i] += pm.acc[i].x;
+            bodies.ay[i] += pm.acc[i].y;
+            bodies.az[i] += pm.acc[i].z;
+        });
     }
 };
 
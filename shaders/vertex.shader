@@ -1,21 +1,22 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aColor;
+layout (location = 1) in float aMass;
+layout (location = 2) in vec3 aVelocity;
 
 out vec3 ourColor;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
-uniform float mass;
-uniform vec3 velocity;
-
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-    if(mass > 1.0f)
+    gl_Position = projection * view * vec4(aPos, 1.0);
+    if(aMass > 1.0f) {
+        gl_PointSize = 4.0;
         ourColor = vec3(0, 1.0, 0);
-    else
-        ourColor = vec3(mass, 0.0, 0.0);
+    }
+    else {
+        gl_PointSize = 2.0;
+        ourColor = vec3(aMass, 0.0, 0.0);
+    }
 }
\ No newline at end of file
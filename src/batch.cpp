@@ -0,0 +1,225 @@
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "../include/glm/glm.hpp"
+
+#include "../include/universe.h"
+#include "../include/checkpoint.h"
+#include "../include/trajectory.h"
+
+static const char* solver_name(ForceSolver solver) {
+    if(solver == FAST_MULTIPOLE)
+        return "fmm";
+    if(solver == PARTICLE_MESH)
+        return "pm";
+    if(solver == TREE_PM)
+        return "treepm";
+    return "bh";
+}
+
+static const char* USAGE =
+    "usage: universe_batch [bodies] [steps] [threads] [dt] [pointer|linear] [bh|fmm|pm|treepm] [grid] [split] "
+    "[refit] [max rung] [euler|kdk|yoshida4] [error samples] [merge radius] [seed] [checkpoint] [checkpoint every] "
+    "[restart] [trajectory] [trajectory every] [trajectory depth] [theta] [monopole|quadrupole]";
+
+//PM grid cells per side, the whole argument has to be a power of two >= 2
+static bool parse_grid(const char *arg, unsigned int &grid) {
+    char *end = NULL;
+    errno = 0;
+    unsigned long value = strtoul(arg, &end, 10);
+    if(errno != 0 || end == arg || *end != '\0' || arg[0] == '-' || value > UINT_MAX ||
+       !PmSolver::valid_grid((unsigned int)value))
+        return false;
+    grid = (unsigned int)value;
+    return true;
+}
+
+//headless runner, no window and no GL context
+int main(int argc, char* argv[]) {
+    int num_bodies = 3000;
+    int steps = 100;
+    unsigned int threads = 0;
+    double dt = 1.0 / 60.0;
+    TreeBuilder builder = LINEAR_TREE;
+    ForceSolver solver = BARNES_HUT;
+    unsigned int grid = 64;
+    double split = 1.25;
+    double refit = 0.0;
+    int rungs = 0;
+    std::string integrator = "kdk";
+    int error_samples = 0;
+    double merge_radius = 0.0;
+    long long seed = -1;
+    std::string checkpoint;
+    int checkpoint_every = 0;
+    std::string restart;
+    std::string trajectory;
+    int trajectory_every = 1;
+    unsigned int trajectory_depth = 4;
+    double theta = 0.5;
+    MultipoleOrder expansion = MONOPOLE;
+
+    if(argc > 1)
+        num_bodies = atoi(argv[1]);
+    if(argc > 2)
+        steps = atoi(argv[2]);
+    if(argc > 3)
+        threads = atoi(argv[3]);
+    if(argc > 4)
+        dt = atof(argv[4]);
+    if(argc > 5)
+        builder = (std::string(argv[5]) == "pointer") ? POINTER_TREE : LINEAR_TREE;
+    if(argc > 6) {
+        std::string name = argv[6];
+        solver = (name == "fmm") ? FAST_MULTIPOLE : (name == "pm") ? PARTICLE_MESH :
+                 (name == "treepm") ? TREE_PM : BARNES_HUT;
+    }
+    if(argc > 7 && !parse_grid(argv[7], grid)) {
+        fprintf(stderr, "grid must be a power of two of at least 2, got '%s'\n%s\n", argv[7], USAGE);
+        return 1;
+    }
+    if(argc > 8)
+        split = atof(argv[8]);
+    if(argc > 9)
+        refit = atof(argv[9]);
+    if(argc > 10)
+        rungs = atoi(argv[10]);
+    if(argc > 11)
+        integrator = argv[11];
+    if(argc > 12)
+        error_samples = atoi(argv[12]);
+    if(argc > 13)
+        merge_radius = atof(argv[13]);
+    if(argc > 14)
+        seed = atoll(argv[14]);
+    if(argc > 15)
+        checkpoint = argv[15];
+    if(argc > 16)
+        checkpoint_every = atoi(argv[16]);
+    if(argc > 17)
+        restart = argv[17];
+    if(argc > 18)
+        trajectory = argv[18];
+    if(argc > 19)
+        trajectory_every = std::max(atoi(argv[19]), 1);
+    if(argc > 20)
+        trajectory_depth = atoi(argv[20]);
+    if(argc > 21)
+        theta = atof(argv[21]);
+    if(argc > 22)
+        expansion = (std::string(argv[22]) == "quadrupole") ? QUADRUPOLE : MONOPOLE;
+
+    Universe uni = Universe(num_bodies, 1000.0f);
+    uni.builder = builder;
+    uni.solver = solver;
+    uni.pm.set_grid(grid);
+    uni.linear_tree.theta = theta;
+    uni.linear_tree.expansion = expansion;
+    uni.split_scale = split;
+    uni.refit_tree = refit > 0.0;
+    if(uni.refit_tree)
+        uni.refit_threshold = refit;
+    uni.block_timesteps = rungs > 0;
+    uni.max_rung = rungs;
+    uni.set_integrator(make_integrator(integrator));
+    uni.merge_collisions = merge_radius > 0.0;
+    uni.collision_radius = merge_radius;
+    uni.set_threads(threads);
+    if(seed >= 0)
+        uni.seed = seed;
+
+    //a restart replaces the generated bodies and every saved setting
+    if(restart.empty()) {
+        uni.generate(glm::dvec3(1000.0f, 1000.0f, 250.0f));
+    }
+    else {
+        std::string error;
+        auto load_start = std::chrono::steady_clock::now();
+        if(!load_checkpoint(uni, restart, error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        double load_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count();
+        printf("restart: %s at step %llu, %.3f s\n", restart.c_str(), (unsigned long long)uni.step_count, load_seconds);
+    }
+
+    //every checkpoint_every steps in the background, and once at the end
+    CheckpointWriter writer;
+    int checkpoints = 0;
+
+    //positions every trajectory_every steps, streamed by the writer thread
+    TrajectoryWriter frames;
+    frames.depth = trajectory_depth;
+    if(!trajectory.empty() && !frames.open(trajectory)) {
+        fprintf(stderr, "%s\n", frames.error.c_str());
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < steps; i++) {
+        uni.simulate(dt);
+        if(frames.is_open() && (i + 1) % trajectory_every == 0)
+            frames.push(uni.bodies, uni.pool, uni.step_count, uni.sim_time);
+        if(!checkpoint.empty() && checkpoint_every > 0 && (i + 1) % checkpoint_every == 0 && i + 1 < steps) {
+            //reports the write before this one, the last one is checked below
+            if(!writer.start(uni, checkpoint)) {
+                fprintf(stderr, "%s\n", writer.error.c_str());
+                return 1;
+            }
+            checkpoints++;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    if(frames.is_open() && !frames.close()) {
+        fprintf(stderr, "%s\n", frames.error.c_str());
+        return 1;
+    }
+
+    if(!checkpoint.empty()) {
+        if(writer.start(uni, checkpoint))
+            checkpoints++;
+        if(!writer.wait()) {
+            fprintf(stderr, "%s\n", writer.error.c_str());
+            return 1;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    printf("bodies: %zu, steps: %d, threads: %u, tree: %s, solver: %s, integrator: %s\n", uni.bodies.size(), steps,
+           uni.pool.size(), uni.builder == LINEAR_TREE ? "linear" : "pointer", solver_name(uni.solver),
+           uni.block_timesteps ? "block kdk" : uni.integrator->name());
+    printf("seed: %llu\n", (unsigned long long)uni.seed);
+    if(uni.uses_linear_tree())
+        printf("theta: %.2f, expansion: %s\n", uni.linear_tree.theta,
+               uni.linear_tree.expansion == QUADRUPOLE ? "quadrupole" : "monopole");
+    printf("time: %.3f s, %.2f steps/s\n", seconds, steps / seconds);
+    printf("root: %.1f ly, outside: %zu bodies\n", 2.0 * uni.root_length / 9.4e15, uni.outside_bodies);
+    printf("tree builds: %zu, refits: %zu\n", uni.tree_builds, uni.tree_refits);
+    printf("force evaluations: %.1f bodies/step\n", (double)uni.force_evaluations / steps);
+    if(uni.merge_collisions)
+        printf("merged: %zu bodies\n", uni.merged_bodies);
+    if(!trajectory.empty()) {
+        TrajectoryStats t = frames.statistics();
+        printf("trajectory: %zu of %zu frames, %.1f MB to %s, depth %u\n", t.written, t.frames,
+               t.bytes / 1e6, trajectory.c_str(), frames.depth);
+        printf("back-pressure: %zu stalls, %.3f s stalled, %zu dropped, max queued %zu\n",
+               t.stalls, t.stall_seconds, t.dropped, t.max_queued);
+    }
+    if(!checkpoint.empty())
+        printf("checkpoints: %d to %s, step %llu\n", checkpoints, checkpoint.c_str(), (unsigned long long)uni.step_count);
+
+    if(error_samples > 0) {
+        ForceError e = uni.force_error(error_samples);
+        printf("force error over %zu bodies: rms %.3e, median %.3e, p99 %.3e, max %.3e\n",
+               e.count, e.rms, e.median, e.p99, e.max);
+    }
+
+    return 0;
+}
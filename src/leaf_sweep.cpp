@@ -0,0 +1,77 @@
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "../include/glm/glm.hpp"
+
+#include "../include/universe.h"
+
+//times the linear tree force pass over a range of leaf bucket sizes on one
+//generated galaxy and reports the fastest, the error columns are against a
+//direct sum over a sample of bodies so a faster K isn't bought with accuracy
+//usage: leaf_sweep [bodies] [repeats] [threads] [theta] [samples] [monopole|quadrupole]
+int main(int argc, char* argv[]) {
+    int num_bodies = 20000;
+    int repeats = 5;
+    unsigned int threads = 0;
+    double theta = 0.5;
+    int samples = 1000;
+    MultipoleOrder expansion = MONOPOLE;
+
+    if(argc > 1)
+        num_bodies = atoi(argv[1]);
+    if(argc > 2)
+        repeats = atoi(argv[2]);
+    if(argc > 3)
+        threads = atoi(argv[3]);
+    if(argc > 4)
+        theta = atof(argv[4]);
+    if(argc > 5)
+        samples = atoi(argv[5]);
+    if(argc > 6)
+        expansion = (std::string(argv[6]) == "quadrupole") ? QUADRUPOLE : MONOPOLE;
+
+    Universe uni = Universe(num_bodies, 1000.0f);
+    uni.set_threads(threads);
+    uni.generate(glm::dvec3(1000.0f, 1000.0f, 250.0f));
+    uni.linear_tree.theta = theta;
+    uni.linear_tree.expansion = expansion;
+
+    //positions never change, one reference serves every K
+    uni.compute_forces();
+    uni.direct.pick_sample(uni.bodies.size(), samples);
+    uni.direct.evaluate(uni.bodies, uni.pool);
+
+    printf("bodies: %zu, threads: %u, group: %u, theta: %.2f, expansion: %s, samples: %zu\n", uni.bodies.size(),
+           uni.pool.size(), uni.linear_tree.group_size, theta, expansion == QUADRUPOLE ? "quadrupole" : "monopole",
+           uni.direct.sample.size());
+    printf("%6s %12s %10s %12s %12s\n", "K", "ms/step", "nodes", "rms error", "p99 error");
+
+    unsigned int best_k = 0;
+    double best_time = 0.0;
+    for(unsigned int k : {1u, 2u, 4u, 8u, 12u, 16u, 24u, 32u, 48u, 64u}) {
+        uni.linear_tree.leaf_size = k;
+
+        //best of the repeats, the first one also warms the buffers
+        double seconds = 1e30;
+        for(int r = 0; r < repeats; r++) {
+            auto start = std::chrono::steady_clock::now();
+            uni.compute_forces();
+            auto end = std::chrono::steady_clock::now();
+            seconds = std::min(seconds, std::chrono::duration<double>(end - start).count());
+        }
+
+        ForceError error = uni.direct.compare(uni.bodies);
+        printf("%6u %12.3f %10zu %12.3e %12.3e\n", k, seconds * 1e3, uni.linear_tree.nodes.size(), error.rms, error.p99);
+        if(best_k == 0 || seconds < best_time) {
+            best_k = k;
+            best_time = seconds;
+        }
+    }
+
+    printf("best K: %u\n", best_k);
+    return 0;
+}
@@ -17,6 +17,7 @@
 #include "../include/body3d.h"
 #include "../include/node3d.h"
 #include "../include/universe.h"
+#include "../include/simulation_thread.h"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
@@ -82,6 +83,13 @@ int main(int argc, char* argv[]) {
     uni.generate(glm::dvec3(1000.0f, 1000.0f, 250.0f));
     uni.setup();
 
+    //physics steps at a fixed dt on its own thread, independent of the frame rate
+    double sim_dt = 1.0 / 60.0;
+    if(argc > 1)
+        sim_dt = atof(argv[1]);
+    SimulationThread sim(uni, sim_dt);
+    sim.start();
+
     while(!glfwWindowShouldClose(window)) {
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
@@ -92,7 +100,6 @@ int main(int argc, char* argv[]) {
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        uni.simulate(deltaTime);
         shader.use();
 
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 20000.0f);
@@ -101,12 +108,13 @@ int main(int argc, char* argv[]) {
         glm::mat4 view = camera.GetViewMatrix();
         shader.setMat4("view", view);
 
-        uni.draw(shader);
+        uni.draw(shader, sim.latest());
 
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
 
+    sim.stop();
     glfwTerminate();
     return 0;
 }